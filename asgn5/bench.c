@@ -0,0 +1,648 @@
+#include "defines.h"
+#include "histogram.h"
+#include "huff.h"
+#include "huffman.h"
+#include "io.h"
+#include "node.h"
+#include "profile.h"
+#include "table.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define OPTIONS "hbcszn:r:"
+
+static uint64_t size = 16; // default corpus size in MiB
+static uint64_t rounds = 5; // default number of timed rounds
+static uint32_t options = 0; // options passed to huff_encode()
+
+// Allocation counts, kept by the wrappers below. The bench target is
+// linked with --wrap so that every malloc(), calloc(), and realloc()
+// in the codec goes through them.
+static uint64_t allocations = 0;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t count, size_t n);
+void *__real_realloc(void *p, size_t n);
+
+void *__wrap_malloc(size_t n) {
+    allocations += 1;
+    return __real_malloc(n);
+}
+
+void *__wrap_calloc(size_t count, size_t n) {
+    allocations += 1;
+    return __real_calloc(count, n);
+}
+
+void *__wrap_realloc(void *p, size_t n) {
+    allocations += 1;
+    return __real_realloc(p, n);
+}
+
+// Prints out the usage information and then exits the program
+void print_help(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "  Benchmarks for the Huffman codec.\n"
+                    "  Runs a generated corpus and any given files through the encoder\n"
+                    "  and decoder in memory and checks that each one round-trips.\n\n"
+                    "USAGE\n"
+                    "  ./bench [-h] [-b] [-c] [-s] [-z] [-n size] [-r rounds] [file ...]\n\n"
+                    "OPTIONS\n"
+                    "  -h             Program usage and help.\n"
+                    "  -b             Encode with checksummed blocks and a seek index.\n"
+                    "  -c             Encode with order-1 context tables.\n"
+                    "  -s             Encode each block as 4 interleaved streams.\n"
+                    "  -z             Run-length code the input before encoding it.\n"
+                    "  -n size        Size of each generated case in MiB (default: 16).\n"
+                    "  -r rounds      Timed rounds per case (default: 5).\n");
+    exit(0);
+}
+
+// The original histogram loop from encode.c, kept as a baseline.
+//
+// buf: bytes to count
+// n: number of bytes in buf
+// hist: histogram that the counts are added to
+static void histogram_naive(const uint8_t *buf, size_t n, uint64_t hist[static ALPHABET]) {
+    for (size_t i = 0; i < n; i += 1) {
+        hist[buf[i]] += 1;
+    }
+}
+
+// Times a histogram kernel over buf and prints the best throughput
+// out of all the rounds in GB/s.
+//
+// name: label printed with the result
+// build: histogram kernel being timed
+// buf: input bytes
+// n: number of bytes in buf
+static void bench_histogram(const char *name,
+    void (*build)(const uint8_t *, size_t, uint64_t *), const uint8_t *buf, size_t n) {
+    double best = 0;
+    uint64_t hist[ALPHABET];
+    for (uint64_t r = 0; r < rounds; r += 1) {
+        memset(hist, 0, sizeof(hist));
+        double start = profile_now();
+        build(buf, n, hist);
+        double elapsed = profile_now() - start;
+        if (best == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    printf("  %-24s %8.2f GB/s\n", name, n / best / 1e9);
+}
+
+// Fills buf with words drawn from a small vocabulary, with the most
+// common words picked far more often than the rest.
+//
+// buf: filled with text
+// n: number of bytes in buf
+static void make_text(uint8_t *buf, size_t n) {
+    static const char *words[] = { "the", "of", "and", "to", "a", "in", "is", "that", "for",
+        "it", "was", "on", "with", "as", "by", "at", "from", "this", "request", "error",
+        "server", "client", "connection", "timeout", "user", "session", "returned", "status" };
+    const uint32_t nwords = sizeof(words) / sizeof(words[0]);
+    size_t i = 0;
+    while (i < n) {
+        // Squaring a uniform number skews the picks toward the front
+        double u = (double) random() / RAND_MAX;
+        const char *w = words[(uint32_t) (u * u * nwords) % nwords];
+        for (size_t j = 0; w[j] && i < n; j += 1) {
+            buf[i++] = w[j];
+        }
+        if (i < n) {
+            buf[i++] = random() % 12 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+// Fills buf with fixed-size binary records of the kind found in
+// database pages or network captures: a counter, a small integer,
+// flags, and a float.
+//
+// buf: filled with records
+// n: number of bytes in buf
+static void make_binary(uint8_t *buf, size_t n) {
+    struct {
+        uint32_t id;
+        uint16_t kind;
+        uint16_t flags;
+        float value;
+    } record;
+    size_t i = 0;
+    for (uint32_t id = 0; i < n; id += 1) {
+        record.id = id;
+        record.kind = random() % 8;
+        record.flags = random() % 4 == 0 ? 0x8000 : 0;
+        record.value = (float) (random() % 10000) / 100;
+        size_t len = n - i < sizeof(record) ? n - i : sizeof(record);
+        memcpy(buf + i, &record, len);
+        i += len;
+    }
+}
+
+// Fills buf with symbols whose probabilities halve from one symbol to
+// the next, which produces a very deep Huffman tree.
+//
+// buf: filled with skewed symbols
+// n: number of bytes in buf
+static void make_skewed(uint8_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i += 1) {
+        uint8_t s = 0;
+        while (s < 40 && random() % 2 == 0) {
+            s += 1;
+        }
+        buf[i] = 'A' + s;
+    }
+}
+
+// Fills buf with uniformly random bytes, which cannot be compressed.
+//
+// buf: filled with random bytes
+// n: number of bytes in buf
+static void make_random(uint8_t *buf, size_t n) {
+    for (size_t i = 0; i < n; i += 1) {
+        buf[i] = random();
+    }
+}
+
+// Fills buf with a single repeated byte.
+//
+// buf: filled with the same byte
+// n: number of bytes in buf
+static void make_same(uint8_t *buf, size_t n) {
+    memset(buf, 'a', n);
+}
+
+// The binary heap of Node pointers that pq.c used before, kept as a
+// baseline. Every enqueue and dequeue rebuilds the whole heap, and
+// comparisons and swaps copy whole Node structs.
+typedef struct {
+    uint32_t top;
+    Node *items[ALPHABET];
+} LegacyQueue;
+
+static int legacy_cmp(Node x, Node y) {
+    return y.frequency < x.frequency ? 1 : 0;
+}
+
+static void legacy_swap(Node *x, Node *y) {
+    Node temp = *x;
+    *x = *y;
+    *y = temp;
+}
+
+static uint32_t legacy_min_child(Node **items, uint32_t first, uint32_t last) {
+    uint32_t left = 2 * first;
+    uint32_t right = left + 1;
+    if ((right <= last) && (legacy_cmp(*items[left - 1], *items[right - 1]) == 1)) {
+        return right;
+    }
+    return left;
+}
+
+static void legacy_fix_heap(Node **items, uint32_t first, uint32_t last) {
+    bool found = false;
+    uint32_t mother = first;
+    uint32_t small = legacy_min_child(items, mother, last);
+    while ((mother <= floor(last / 2.0)) && !(found)) {
+        if (legacy_cmp(*items[mother - 1], *items[small - 1]) == 1) {
+            legacy_swap(items[mother - 1], items[small - 1]);
+            mother = small;
+            small = legacy_min_child(items, mother, last);
+        } else {
+            found = true;
+        }
+    }
+}
+
+static void legacy_build_heap(Node **items, uint32_t first, uint32_t last) {
+    for (uint32_t father = floor(last / 2.0); father > first - 1; father -= 1) {
+        legacy_fix_heap(items, father, last);
+    }
+}
+
+static void legacy_enqueue(LegacyQueue *q, Node *n) {
+    q->items[q->top++] = n;
+    legacy_build_heap(q->items, 1, q->top);
+}
+
+static Node *legacy_dequeue(LegacyQueue *q) {
+    legacy_swap(q->items[0], q->items[q->top - 1]);
+    Node *n = q->items[--q->top];
+    legacy_build_heap(q->items, 1, q->top);
+    return n;
+}
+
+// Frees every node of a tree built from Node structs.
+//
+// n: root of the tree
+static void legacy_free(Node *n) {
+    if (n) {
+        legacy_free(n->left);
+        legacy_free(n->right);
+        node_delete(&n);
+    }
+}
+
+// Builds a Huffman tree the way encode.c used to, with a Node for
+// every leaf and parent and the baseline queue. Returns the cost of
+// the tree, the sum of the frequencies of its parents, which is the
+// number of bits the codes take.
+//
+// hist: histogram the tree is built for
+static uint64_t tree_legacy(uint64_t hist[static ALPHABET]) {
+    LegacyQueue q = { .top = 0 };
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (hist[i] > 0) {
+            legacy_enqueue(&q, node_create(i, hist[i]));
+        }
+    }
+    uint64_t cost = 0;
+    while (q.top > 1) {
+        Node *left = legacy_dequeue(&q);
+        Node *right = legacy_dequeue(&q);
+        Node *parent = node_join(left, right);
+        cost += parent->frequency;
+        legacy_enqueue(&q, parent);
+    }
+    legacy_free(q.top ? q.items[0] : NULL);
+    return cost;
+}
+
+// Orders leaves by frequency, breaking ties by symbol, as the old
+// build_tree() sorted them.
+//
+// x: first leaf to be compared
+// y: second leaf to be compared
+static int cmp_leaves(const void *x, const void *y) {
+    const TreeNode *a = (const TreeNode *) x;
+    const TreeNode *b = (const TreeNode *) y;
+    if (a->frequency != b->frequency) {
+        return a->frequency < b->frequency ? -1 : 1;
+    }
+    return a->symbol - b->symbol;
+}
+
+// The sort and two-queue merge that build_tree() used to be, kept as a
+// baseline and as the reference for how ties are broken. The leaves
+// are sorted to the front of the array, and the interior nodes that
+// are appended after them form a second sorted queue.
+//
+// t: tree that is built
+// hist: histogram the tree is built for
+static void build_tree_two_queues(Tree *t, uint64_t hist[static ALPHABET]) {
+    uint16_t leaves = 0;
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (hist[i] > 0) {
+            t->nodes[leaves] = (TreeNode) {
+                .frequency = hist[i], .left = NO_NODE, .right = NO_NODE, .symbol = i
+            };
+            leaves += 1;
+        }
+    }
+    qsort(t->nodes, leaves, sizeof(TreeNode), cmp_leaves);
+    t->size = leaves;
+    t->root = leaves > 0 ? leaves - 1 : NO_NODE;
+    uint16_t leaf = 0;
+    uint16_t interior = leaves;
+    while (t->size < 2 * leaves - 1) {
+        uint16_t children[2];
+        for (uint32_t k = 0; k < 2; k += 1) {
+            // Take from the leaves on ties
+            if (interior == t->size
+                || (leaf < leaves && t->nodes[leaf].frequency <= t->nodes[interior].frequency)) {
+                children[k] = leaf++;
+            } else {
+                children[k] = interior++;
+            }
+        }
+        t->nodes[t->size] = (TreeNode) { .frequency = t->nodes[children[0]].frequency
+                                                      + t->nodes[children[1]].frequency,
+            .left = children[0],
+            .right = children[1],
+            .symbol = '$' };
+        t->root = t->size;
+        t->size += 1;
+    }
+}
+
+// Returns the cost of a tree, the sum of the frequencies of its
+// parents, which is the number of bits the codes take.
+//
+// t: tree to be measured
+static uint64_t tree_cost(Tree *t) {
+    uint64_t cost = 0;
+    for (uint32_t i = 0; i < t->size; i += 1) {
+        cost += t->nodes[i].left != NO_NODE ? t->nodes[i].frequency : 0;
+    }
+    return cost;
+}
+
+// Builds a Huffman tree with the old two-queue merge. Returns the cost
+// of the tree.
+//
+// hist: histogram the tree is built for
+static uint64_t tree_two_queues(uint64_t hist[static ALPHABET]) {
+    Tree t;
+    build_tree_two_queues(&t, hist);
+    return tree_cost(&t);
+}
+
+// Builds a Huffman tree with build_tree(), the index heap of pq.c that
+// the encoder uses. Returns the cost of the tree.
+//
+// hist: histogram the tree is built for
+static uint64_t tree_build(uint64_t hist[static ALPHABET]) {
+    Tree t;
+    build_tree(&t, hist);
+    return tree_cost(&t);
+}
+
+// Returns whether build_tree() makes exactly the tree of the old
+// two-queue merge for hist, compared by their dumps. The built-in text
+// table is never dumped, so its shape must not change.
+//
+// hist: histogram the trees are built for
+static bool same_tree(uint64_t hist[static ALPHABET]) {
+    Tree a, b;
+    uint8_t dump_a[MAX_TREE_SIZE], dump_b[MAX_TREE_SIZE];
+    build_tree(&a, hist);
+    build_tree_two_queues(&b, hist);
+    uint32_t size = dump_tree(&a, dump_a);
+    return size == dump_tree(&b, dump_b) && memcmp(dump_a, dump_b, size) == 0;
+}
+
+// Times one way of building a Huffman tree and prints how long a
+// build takes in microseconds. Returns false if the tree it builds
+// does not cost the same as the one build_tree() makes.
+//
+// name: label printed with the result
+// build: tree builder being timed
+// hist: histogram the trees are built for
+static bool bench_tree(const char *name, uint64_t (*build)(uint64_t *), uint64_t *hist) {
+    const uint32_t builds = 2000;
+    uint64_t cost = tree_build(hist);
+    bool ok = true;
+    double best = 0;
+    for (uint64_t r = 0; r < rounds; r += 1) {
+        double start = profile_now();
+        for (uint32_t i = 0; i < builds; i += 1) {
+            ok = build(hist) == cost && ok;
+        }
+        double elapsed = profile_now() - start;
+        best = (r == 0 || elapsed < best) ? elapsed : best;
+    }
+    printf("  %-24s %8.2f us/tree  %s\n", name, best / builds * 1e6, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// Encodes and decodes one case rounds times, checks that the decoded
+// data matches the input, and prints the compression ratio, the best
+// encode and decode throughput in MB/s, and the allocations made per
+// round trip. Returns false if the case did not round-trip.
+//
+// name: label printed with the results
+// data: input bytes
+// n: number of bytes in data
+static bool bench_case(const char *name, const uint8_t *data, uint64_t n) {
+    uint64_t bound = huff_compress_bound(n);
+    uint8_t *archive = (uint8_t *) malloc(bound);
+    uint8_t *decoded = (uint8_t *) malloc(n ? n : 1);
+    if (!archive || !decoded) {
+        fprintf(stderr, "Failed to allocate buffers for %s.\n", name);
+        exit(1);
+    }
+
+    double best_encode = 0;
+    double best_decode = 0;
+    uint64_t archive_size = 0;
+    uint64_t before = allocations;
+    bool ok = true;
+    for (uint64_t r = 0; r < rounds && ok; r += 1) {
+        archive_size = bound;
+        double start = profile_now();
+        ok = huff_encode(data, n, 0644, options, archive, &archive_size, NULL, NULL, NULL);
+        double elapsed = profile_now() - start;
+        best_encode = (r == 0 || elapsed < best_encode) ? elapsed : best_encode;
+
+        uint64_t decoded_size = n;
+        start = profile_now();
+        ok = ok && huff_decode(archive, archive_size, decoded, &decoded_size, NULL, NULL, NULL);
+        elapsed = profile_now() - start;
+        best_decode = (r == 0 || elapsed < best_decode) ? elapsed : best_decode;
+
+        ok = ok && decoded_size == n && memcmp(data, decoded, n) == 0;
+    }
+    uint64_t allocs = (allocations - before) / rounds;
+
+    printf("  %-20s %10" PRIu64 " %8.4f %10.2f %10.2f %8" PRIu64 "  %s\n", name, n,
+        n ? (double) archive_size / n : 0, n / best_encode / 1e6, n / best_decode / 1e6, allocs,
+        ok ? "ok" : "FAILED");
+    free(archive);
+    free(decoded);
+    return ok;
+}
+
+// Encodes and decodes records of record bytes each, one archive per
+// record, and prints the average archive size and the time to encode
+// and decode each record. Returns false if a record did not round-trip.
+//
+// name: label printed with the results
+// data: records, one after the other
+// n: number of bytes in data
+// record: bytes in each record
+// shared: table the records are coded with, or NULL
+static bool bench_records(
+    const char *name, const uint8_t *data, uint64_t n, uint64_t record, SharedTable *shared) {
+    uint64_t records = n / record;
+    uint64_t bound = huff_compress_bound(record);
+    uint8_t *archives = (uint8_t *) malloc(records * bound);
+    uint64_t *sizes = (uint64_t *) malloc(records * sizeof(uint64_t));
+    uint8_t *decoded = (uint8_t *) malloc(record);
+    if (!archives || !sizes || !decoded) {
+        fprintf(stderr, "Failed to allocate buffers for %s.\n", name);
+        exit(1);
+    }
+
+    double best_encode = 0;
+    double best_decode = 0;
+    uint64_t total = 0;
+    bool ok = true;
+    for (uint64_t r = 0; r < rounds && ok; r += 1) {
+        double start = profile_now();
+        for (uint64_t i = 0; i < records && ok; i += 1) {
+            sizes[i] = bound;
+            ok = huff_encode(data + i * record, record, 0644, options, archives + i * bound,
+                &sizes[i], NULL, NULL, shared);
+        }
+        double elapsed = profile_now() - start;
+        best_encode = (r == 0 || elapsed < best_encode) ? elapsed : best_encode;
+
+        start = profile_now();
+        for (uint64_t i = 0; i < records && ok; i += 1) {
+            uint64_t size = record;
+            ok = huff_decode(archives + i * bound, sizes[i], decoded, &size, NULL, NULL, shared)
+                 && size == record && memcmp(data + i * record, decoded, record) == 0;
+        }
+        elapsed = profile_now() - start;
+        best_decode = (r == 0 || elapsed < best_decode) ? elapsed : best_decode;
+    }
+    for (uint64_t i = 0; i < records; i += 1) {
+        total += sizes[i];
+    }
+
+    printf("  %-20s %10" PRIu64 " %8.4f %10.2f %10.2f  %s\n", name, record,
+        (double) total / (records * record), best_encode / records * 1e6,
+        best_decode / records * 1e6, ok ? "ok" : "FAILED");
+    free(archives);
+    free(sizes);
+    free(decoded);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'b': options |= FLAG_BLOCKS; break;
+        case 'c': options |= FLAG_CONTEXT; break;
+        case 's': options |= FLAG_STREAMS; break;
+        case 'z': options |= FLAG_RLE; break;
+        case 'n': size = strtoull(optarg, NULL, 10); break;
+        case 'r': rounds = strtoull(optarg, NULL, 10); break;
+        case 'h': print_help(); break;
+        default: print_help(); break;
+        }
+    }
+    if (size == 0 || rounds == 0) {
+        print_help();
+    }
+
+    size_t n = size << 20;
+    uint8_t *buf = (uint8_t *) malloc(n);
+    if (!buf) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " MiB.\n", size);
+        return 1;
+    }
+    srandom(13371453);
+
+    // Histogram kernels on the two extremes
+    make_random(buf, n);
+    printf("histogram (uniform random, %" PRIu64 " MiB)\n", size);
+    bench_histogram("naive", histogram_naive, buf, n);
+    bench_histogram("histogram_build", histogram_build, buf, n);
+    make_same(buf, n);
+    printf("histogram (all-same byte, %" PRIu64 " MiB)\n", size);
+    bench_histogram("naive", histogram_naive, buf, n);
+    bench_histogram("histogram_build", histogram_build, buf, n);
+
+    // Tree builders on a text histogram and on all 256 symbols with
+    // frequencies spread over many orders of magnitude
+    bool ok = true;
+    uint64_t text_hist[ALPHABET] = { 0 };
+    uint64_t wide_hist[ALPHABET];
+    make_text(buf, n);
+    histogram_build(buf, n, text_hist);
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        wide_hist[i] = 1 + ((uint64_t) random() >> (random() % 31));
+    }
+    struct {
+        const char *name;
+        uint64_t *hist;
+    } hists[] = { { "text", text_hist }, { "256 symbols", wide_hist } };
+    for (uint32_t i = 0; i < sizeof(hists) / sizeof(hists[0]); i += 1) {
+        printf("huffman tree (%s)\n", hists[i].name);
+        ok = bench_tree("legacy pq of Node *", tree_legacy, hists[i].hist) && ok;
+        ok = bench_tree("two queues (old)", tree_two_queues, hists[i].hist) && ok;
+        ok = bench_tree("index pq (build_tree)", tree_build, hists[i].hist) && ok;
+    }
+
+    // Ties have to be broken as before, on the built-in text table and
+    // on small random frequencies, which tie all the time
+    const uint32_t tie_cases = 10000;
+    uint64_t tie_hist[ALPHABET];
+    default_histogram(tie_hist);
+    bool same = same_tree(tie_hist) && same_tree(text_hist) && same_tree(wide_hist);
+    for (uint32_t i = 0; i < tie_cases; i += 1) {
+        for (uint32_t j = 0; j < ALPHABET; j += 1) {
+            tie_hist[j] = random() % 4 == 0 ? 0 : 1 + random() % (1 + i % 8);
+        }
+        same = same_tree(tie_hist) && same;
+    }
+    printf("huffman tree ties (%u histograms)  %s\n", tie_cases + 3, same ? "ok" : "FAILED");
+    ok = same && ok;
+
+    // Generated corpus, plus a small text case for the built-in table
+    struct {
+        const char *name;
+        void (*make)(uint8_t *, size_t);
+        size_t n;
+    } corpus[] = { { "text", make_text, n }, { "binary", make_binary, n },
+        { "all-same", make_same, n }, { "uniform-random", make_random, n },
+        { "skewed", make_skewed, n }, { "small-text", make_text, 1000 } };
+
+    printf("codec (%s%s%s%s)\n", options & FLAG_BLOCKS ? "indexed blocks" : "plain",
+        options & FLAG_CONTEXT ? ", order-1" : "", options & FLAG_STREAMS ? ", 4 streams" : "",
+        options & FLAG_RLE ? ", run-length" : "");
+    printf("  %-20s %10s %8s %10s %10s %8s\n", "case", "bytes", "ratio", "enc MB/s", "dec MB/s",
+        "allocs");
+    for (uint32_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); i += 1) {
+        corpus[i].make(buf, corpus[i].n);
+        ok = bench_case(corpus[i].name, buf, corpus[i].n) && ok;
+    }
+
+    // Small records of the same kind, each compressed on its own, with
+    // and without a shared table trained on other records like them
+    const uint64_t record = 512;
+    const uint64_t records = 4096;
+    SharedTable *shared = (SharedTable *) malloc(sizeof(SharedTable));
+    if (!shared || n < 2 * record * records) {
+        fprintf(stderr, "Failed to set up the record cases.\n");
+        return 1;
+    }
+    printf("small records (%" PRIu64 " records each)\n", records);
+    printf("  %-20s %10s %8s %10s %10s\n", "case", "bytes", "ratio", "enc us", "dec us");
+    struct {
+        const char *name;
+        const char *trained;
+        void (*make)(uint8_t *, size_t);
+    } kinds[] = { { "text", "text, shared table", make_text },
+        { "binary", "binary, shared table", make_binary } };
+    for (uint32_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i += 1) {
+        uint64_t hist[ALPHABET] = { 0 };
+        kinds[i].make(buf, 2 * record * records);
+        histogram_build(buf + record * records, record * records, hist);
+        table_train(shared, hist);
+        ok = bench_records(kinds[i].name, buf, record * records, record, NULL) && ok;
+        ok = bench_records(kinds[i].trained, buf, record * records, record, shared) && ok;
+    }
+    free(shared);
+    free(buf);
+
+    // Files named on the command line
+    for (int i = optind; i < argc; i += 1) {
+        int fd = open(argv[i], O_RDONLY);
+        Mapping m;
+        if (fd < 0 || !io_map(fd, &m)) {
+            fprintf(stderr, "Failed to read %s.\n", argv[i]);
+            return 1;
+        }
+        ok = bench_case(argv[i], m.data, m.size) && ok;
+        io_unmap(&m);
+        close(fd);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("peak RSS: %ld KiB\n", usage.ru_maxrss);
+    return ok ? 0 : 1;
+}
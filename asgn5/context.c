@@ -0,0 +1,212 @@
+#include "context.h"
+#include "defines.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes of the group count and the context map at the start of a dump.
+#define MAP_SIZE (1 + ALPHABET)
+
+typedef struct {
+    int64_t gain; // Bits saved by giving the context a table of its own.
+    uint8_t context;
+} Candidate;
+
+// Orders candidates from the largest gain to the smallest, breaking
+// ties by context so that the same input always gives the same model.
+//
+// x: first candidate to be compared
+// y: second candidate to be compared
+static int cmp_gain(const void *x, const void *y) {
+    const Candidate *a = (const Candidate *) x;
+    const Candidate *b = (const Candidate *) y;
+    if (a->gain != b->gain) {
+        return a->gain > b->gain ? -1 : 1;
+    }
+    return a->context - b->context;
+}
+
+// Builds a tree for hist with the two symbols that every tree gets, so
+// that there are always at least two leaves.
+//
+// t: tree that is built
+// hist: histogram of the symbols, left unchanged
+static void build_padded(Tree *t, uint64_t hist[static ALPHABET]) {
+    uint64_t padded[ALPHABET];
+    memcpy(padded, hist, sizeof(padded));
+    padded[0] += 1;
+    padded[255] += 1;
+    build_tree(t, padded);
+}
+
+// Returns the number of bits needed to code hist with table.
+//
+// hist: histogram of the symbols
+// table: code for each symbol
+static uint64_t coded_bits(uint64_t hist[static ALPHABET], Code table[static ALPHABET]) {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (hist[i] > 0) {
+            bits += hist[i] * code_size(&table[i]);
+        }
+    }
+    return bits;
+}
+
+// Counts every symbol of buf under the context of the byte before it.
+// The context goes back to 0 at the start of every SEEK_BLOCK, and at
+// the start of each of the streams that a block is split into.
+//
+// buf: bytes to count
+// n: number of bytes in buf
+// streams: number of streams per block, 1 if blocks are not split
+// hist: histogram of each context, which the counts are added to
+void context_histogram(
+    const uint8_t *buf, uint64_t n, uint32_t streams, uint64_t hist[ALPHABET][ALPHABET]) {
+    for (uint64_t first = 0; first < n; first += SEEK_BLOCK) {
+        uint64_t count = n - first < SEEK_BLOCK ? n - first : SEEK_BLOCK;
+        uint64_t length = (count + streams - 1) / streams;
+        for (uint64_t start = 0; start < count; start += length) {
+            uint64_t end = count - start < length ? count : start + length;
+            uint8_t prev = 0;
+            for (uint64_t i = first + start; i < first + end; i += 1) {
+                hist[prev][buf[i]] += 1;
+                prev = buf[i];
+            }
+        }
+    }
+}
+
+// Groups the contexts and builds a tree for each group. A context gets
+// a group of its own when its table saves more bits than it costs to
+// dump, judged against the order-0 table of the whole input. The
+// contexts with the largest savings are picked first, up to ALPHABET-1
+// of them and as many as fit in a dump of UINT16_MAX bytes. The rest
+// share group 0, whose tree is built from their combined histogram.
+//
+// m: model that is built
+// hist: histogram of each context from context_histogram()
+void context_build(ContextModel *m, uint64_t hist[ALPHABET][ALPHABET]) {
+    Tree tree;
+    Code order0[ALPHABET];
+    Code own[ALPHABET];
+    uint8_t dump[MAX_TREE_SIZE];
+
+    // Table of the whole input to compare each context against
+    uint64_t total[ALPHABET] = { 0 };
+    for (uint32_t c = 0; c < ALPHABET; c += 1) {
+        for (uint32_t i = 0; i < ALPHABET; i += 1) {
+            total[i] += hist[c][i];
+        }
+    }
+    build_padded(&tree, total);
+    build_codes(&tree, order0);
+
+    Candidate candidates[ALPHABET];
+    uint32_t sizes[ALPHABET] = { 0 };
+    for (uint32_t c = 0; c < ALPHABET; c += 1) {
+        candidates[c].context = c;
+        candidates[c].gain = 0;
+        uint64_t bits = coded_bits(hist[c], order0);
+        if (bits > 0) {
+            build_padded(&tree, hist[c]);
+            build_codes(&tree, own);
+            sizes[c] = dump_tree(&tree, dump);
+            candidates[c].gain
+                = (int64_t) bits - (int64_t) coded_bits(hist[c], own) - 8 * (2 + sizes[c]);
+        }
+    }
+    qsort(candidates, ALPHABET, sizeof(Candidate), cmp_gain);
+
+    // Give the best contexts their own groups while the dump has room
+    memset(m->map, 0, sizeof(m->map));
+    m->groups = 1;
+    uint32_t size = MAP_SIZE + 2 + MAX_TREE_SIZE;
+    for (uint32_t k = 0; k < ALPHABET - 1 && candidates[k].gain > 0; k += 1) {
+        uint8_t c = candidates[k].context;
+        if (size + 2 + sizes[c] > UINT16_MAX) {
+            continue;
+        }
+        size += 2 + sizes[c];
+        m->map[c] = m->groups;
+        build_padded(&m->trees[m->groups], hist[c]);
+        m->groups += 1;
+    }
+
+    // Every other context shares group 0
+    uint64_t rest[ALPHABET] = { 0 };
+    for (uint32_t c = 0; c < ALPHABET; c += 1) {
+        if (m->map[c] == 0) {
+            for (uint32_t i = 0; i < ALPHABET; i += 1) {
+                rest[i] += hist[c][i];
+            }
+        }
+    }
+    build_padded(&m->trees[0], rest);
+}
+
+// Dumps the model into buf: the number of groups less one, the group
+// of every context, and then the size and dump of each group's tree.
+// buf must have room for the size context_build() allowed for, which
+// is at most UINT16_MAX bytes. Returns the number of bytes in the dump.
+//
+// m: model that is dumped
+// buf: buffer the dump is written into
+uint32_t context_dump(ContextModel *m, uint8_t *buf) {
+    buf[0] = m->groups - 1;
+    memcpy(buf + 1, m->map, ALPHABET);
+    uint32_t n = MAP_SIZE;
+    for (uint32_t g = 0; g < m->groups; g += 1) {
+        uint16_t size = dump_tree(&m->trees[g], buf + n + 2);
+        memcpy(buf + n, &size, sizeof(size));
+        n += 2 + size;
+    }
+    return n;
+}
+
+// Rebuilds a model from its dump. Returns false if the dump is cut
+// short, maps a context to a group that is not there, or holds an
+// invalid tree.
+//
+// m: model that is rebuilt
+// nbytes: length of the dump
+// buf: the dump
+bool context_rebuild(ContextModel *m, uint32_t nbytes, const uint8_t *buf) {
+    if (nbytes < MAP_SIZE) {
+        return false;
+    }
+    m->groups = buf[0] + 1;
+    memcpy(m->map, buf + 1, ALPHABET);
+    for (uint32_t c = 0; c < ALPHABET; c += 1) {
+        if (m->map[c] >= m->groups) {
+            return false;
+        }
+    }
+    uint32_t n = MAP_SIZE;
+    for (uint32_t g = 0; g < m->groups; g += 1) {
+        uint16_t size;
+        if (nbytes - n < 2) {
+            return false;
+        }
+        memcpy(&size, buf + n, sizeof(size));
+        n += 2;
+        if (size > MAX_TREE_SIZE || nbytes - n < size
+            || !rebuild_tree(&m->trees[g], size, buf + n)) {
+            return false;
+        }
+        n += size;
+    }
+    return n == nbytes;
+}
+
+// Returns the length of the longest code in any of the model's tables.
+//
+// m: model that is measured
+uint32_t context_depth(ContextModel *m) {
+    uint32_t depth = 0;
+    for (uint32_t g = 0; g < m->groups; g += 1) {
+        uint32_t d = tree_depth(&m->trees[g]);
+        depth = d > depth ? d : depth;
+    }
+    return depth;
+}
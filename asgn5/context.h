@@ -0,0 +1,29 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "huffman.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Order-1 model: each symbol is coded with the table of the group that
+// the byte before it belongs to. The first byte of every SEEK_BLOCK,
+// and of every stream in a block, has the context 0, so blocks and
+// streams can still be decoded on their own.
+typedef struct {
+    uint16_t groups; // Number of tables, between 1 and ALPHABET.
+    uint8_t map[ALPHABET]; // Group of each context. Group 0 is shared by the rest.
+    Tree trees[ALPHABET]; // Tree of each group.
+} ContextModel;
+
+void context_histogram(
+    const uint8_t *buf, uint64_t n, uint32_t streams, uint64_t hist[ALPHABET][ALPHABET]);
+
+void context_build(ContextModel *m, uint64_t hist[ALPHABET][ALPHABET]);
+
+uint32_t context_dump(ContextModel *m, uint8_t *buf);
+
+bool context_rebuild(ContextModel *m, uint32_t nbytes, const uint8_t *buf);
+
+uint32_t context_depth(ContextModel *m);
@@ -1,8 +1,13 @@
 #include "defines.h"
 #include "header.h"
-#include "huffman.h"
+#include "huff.h"
 #include "io.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "table.h"
 
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -11,57 +16,10 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvjpr:t:i:o:"
 
-// Used to keep track of compressed/decompressed file sizes
-uint64_t bytes_read;
-uint64_t bytes_written;
-
-static uint8_t buf[BLOCK] = { 0 };
-static uint64_t decoded_symbols = 0;
-static uint64_t counter = 0;
-// Traverses the tree and buffers each symbol based on the bits
-// that are read in from the infile. Once the buffer is full or
-// the number of decoded symbols equals the file size, it is
-// written to outfile.
-//
-// infile: contains the bits that represent the codes
-// outfile: where to print out the buffered symbols
-// current_node: keeps track of the current node
-// root_node: keeps track of root node so we can return to it
-// file_size: how many bytes need to be printed out
-void traverse(int infile, int outfile, Node *current_node, Node *root_node, uint64_t file_size) {
-    uint8_t bit = 0;
-    if (current_node && root_node) {
-        while (decoded_symbols < file_size) {
-            // Read the next bit, traverse left or right depending on value
-            read_bit(infile, &bit);
-            if (bit == 0) {
-                current_node = current_node->left;
-            } else {
-                current_node = current_node->right;
-            }
-
-            // If a leaf node is reached, buffer symbol and return to root node
-            if (!current_node->left && !current_node->right) {
-                buf[counter] = current_node->symbol;
-                decoded_symbols += 1;
-                counter += 1;
-                current_node = root_node;
-            }
-
-            if (counter == BLOCK) {
-                // Write the full buffer to outfile
-                write_bytes(outfile, buf, BLOCK);
-                counter = 0;
-            } else if (decoded_symbols == file_size) {
-                // Write the decoded message to outfile
-                write_bytes(outfile, buf, counter);
-            }
-        }
-        return;
-    }
-}
+static struct option long_options[] = { { "table", required_argument, NULL, 't' },
+    { NULL, 0, NULL, 0 } };
 
 // Prints out the usage information and then exits the program
 void print_help() {
@@ -69,27 +27,37 @@ void print_help() {
                     "  A Huffman decoder.\n"
                     "  Decompresses a file using the Huffman coding algorithm.\n\n"
                     "USAGE\n"
-                    "  ./decode [-h] [-v] [-i infile] [-o outfile]\n\n"
+                    "  ./decode [-h] [-v] [-j] [-p] [-r start:length] [--table table] [-i infile]\n"
+                    "           [-o outfile]\n\n"
                     "OPTIONS\n"
                     "  -h             Program usage and help.\n"
                     "  -v             Print compression statistics.\n"
+                    "  -j             Print a JSON profile of the decompression.\n"
+                    "  -p             Write the output on a second thread while decoding.\n"
+                    "  -r start:length  Only decompress length bytes from offset start.\n"
+                    "  -t, --table table  Shared table the input was compressed with.\n"
                     "  -i infile      Input file to decompress.\n"
                     "  -o outfile     Output of decompressed data.\n");
     exit(0);
 }
 
-// Prints out the compressed and decompressed file sizes and the
-// percentage of space saved.
+// Prints out the compressed and decompressed file sizes, the
+// percentage of space saved, the throughput, and the number of
+// system calls used for I/O.
 //
 // compressed_size: size (bytes) of the compressed input file
 // decompressed_size: size (bytes) of the decompressed output file
-void print_stats(uint64_t compressed_size, uint64_t decompressed_size) {
+// seconds: time taken to decompress the file
+void print_stats(uint64_t compressed_size, uint64_t decompressed_size, double seconds) {
     float space_saving = 100 * (1 - ((double) compressed_size / (double) decompressed_size));
     fprintf(stderr,
-        "Compressed file size: %lu\n"
-        "Decompressed file size: %lu\n"
-        "Space saving: %.2f%s\n",
-        compressed_size, decompressed_size, space_saving, "%");
+        "Compressed file size: %" PRIu64 "\n"
+        "Decompressed file size: %" PRIu64 "\n"
+        "Space saving: %.2f%s\n"
+        "Throughput: %.2f MB/s\n"
+        "System calls: %" PRIu64 " (read: %" PRIu64 ", write: %" PRIu64 ", mmap: %" PRIu64 ")\n",
+        compressed_size, decompressed_size, space_saving, "%", decompressed_size / seconds / 1e6,
+        read_calls + write_calls + map_calls, read_calls, write_calls, map_calls);
 }
 
 int main(int argc, char **argv) {
@@ -100,13 +68,32 @@ int main(int argc, char **argv) {
     int outfile = fileno(output);
     bool help = false;
     bool stats = false;
+    bool json = false;
+    bool pipelined = false;
+    uint64_t from = 0;
+    uint64_t length = UINT64_MAX;
+    SharedTable *shared = NULL;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'h': help = true; break;
         case 'i': infile = open(optarg, O_RDONLY); break;
         case 'o': outfile = open(optarg, O_WRONLY | O_TRUNC | O_CREAT); break;
         case 'v': stats = true; break;
+        case 'j': json = true; break;
+        case 'p': pipelined = true; break;
+        case 'r':
+            if (sscanf(optarg, "%" SCNu64 ":%" SCNu64, &from, &length) != 2) {
+                help = true;
+            }
+            break;
+        case 't':
+            shared = (SharedTable *) malloc(sizeof(SharedTable));
+            if (!shared || !table_open(shared, optarg)) {
+                fprintf(stderr, "Failed to load table %s.\n", optarg);
+                exit(1);
+            }
+            break;
         case '?': help = true; break;
         default: help = true; break;
         }
@@ -117,39 +104,94 @@ int main(int argc, char **argv) {
         print_help();
     }
 
-    // Read in the header from infile
-    Header header;
-    Header *header_ptr = &header;
-    uint8_t *bytes_ptr = (uint8_t *) header_ptr;
-    read_bytes(infile, bytes_ptr, sizeof(Header));
+    Profile profile;
+    profile_init(&profile, "decode");
+
+    // Map the whole archive into memory
+    Mapping in;
+    if (!io_map(infile, &in)) {
+        fprintf(stderr, "Failed to read input.\n");
+        exit(1);
+    }
 
-    // If the magic number is invalid, end the program
-    if (header.magic != MAGIC) {
+    // Read in the header to check the magic number and find the size
+    Header header;
+    HeaderExt ext;
+    if (!huff_read_header(in.data, in.size, &header, &ext)) {
+        // If the magic number is invalid, end the program
         fprintf(stderr, "Invalid magic number.\n");
         exit(0);
     }
+    if ((ext.flags & FLAG_TABLE) && (!shared || shared->id != ext.table)) {
+        fprintf(stderr, "Input needs the shared table %08x.\n", ext.table);
+        exit(1);
+    }
+
+    // Check the size in the header against the archive before any
+    // memory is allocated for it
+    uint64_t size = 0;
+    if (!huff_content_size(in.data, in.size, &size)) {
+        fprintf(stderr, "Invalid, truncated, or corrupted input.\n");
+        exit(1);
+    }
+    size = from < size ? size - from : 0;
+    if (length < size) {
+        size = length;
+    }
 
     // Copy the outfile permissions from the header
     fchmod(outfile, header.permissions);
 
-    // Read the dumped tree into an array
-    uint8_t dumped_tree[header.tree_size];
-    read_bytes(infile, &(*dumped_tree), header.tree_size);
-
-    // Reconstruct the Huffman tree starting from root node
-    Node *root = rebuild_tree(header.tree_size, dumped_tree);
-
-    // Traverse the tree using codes from infile to decompress the file
-    traverse(infile, outfile, root, root, header.file_size);
-
-    // Delete the tree
-    delete_tree(&root);
+    // Decompress into memory, then write the decoded data out. When
+    // pipelined, a writer thread writes each part as it is decoded.
+    // Archives with an index can be decoded a window of blocks at a
+    // time instead, which keeps memory bounded, unless the whole output
+    // is needed for the pipeline or the profile.
+    bool windowed = (ext.flags & FLAG_BLOCKS) && !(ext.flags & FLAG_RLE) && !pipelined && !json;
+    uint64_t window = windowed && size > IO_BLOCK ? IO_BLOCK : size;
+    uint8_t *out = (uint8_t *) malloc(window ? window : 1);
+    Pipeline pipeline;
+    HuffSink sink = { .ready = pipeline_ready, .arg = &pipeline };
+    if (!out || (pipelined && !pipeline_start(&pipeline, outfile, out))) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes.\n", window);
+        exit(1);
+    }
+    uint64_t done = 0;
+    do {
+        uint64_t count = size - done < window ? size - done : window;
+        if (!huff_decode_range(in.data, in.size, from + done, count, out, &count,
+                json ? &profile : NULL, pipelined ? &sink : NULL, shared)) {
+            fprintf(stderr, "Invalid, truncated, or corrupted input.\n");
+            exit(1);
+        }
+        // Disk space is only reserved once the archive decodes, which is
+        // too late for the pipeline as its writer has already started
+        if (done == 0 && !pipelined) {
+            io_reserve(outfile, size);
+        }
+        if (pipelined) {
+            pipeline_finish(&pipeline, count);
+        } else {
+            for (uint64_t i = 0; i < count; i += IO_BLOCK) {
+                write_bytes(outfile, out + i, count - i < IO_BLOCK ? count - i : IO_BLOCK);
+            }
+        }
+        done += count;
+    } while (done < size);
+    free(out);
+    free(shared);
 
     // Print out file size statistics to stderr
     if (stats) {
-        print_stats(bytes_read, bytes_written);
+        print_stats(in.size, bytes_written, profile_now() - profile.start);
+    }
+    if (json) {
+        profile_print(stderr, &profile);
     }
 
+    // Release the input
+    io_unmap(&in);
+
     // Close the infile and outfile
     close(infile);
     close(outfile);
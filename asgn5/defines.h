@@ -1,7 +1,23 @@
 #pragma once
 
 #define BLOCK         4096 // 4KB blocks.
+#define IO_BLOCK      (1 << 20) // 1MB blocks for buffered file I/O.
 #define ALPHABET      256 // ASCII + Extended ASCII.
 #define MAGIC         0xBEEFD00D // 32-bit magic number.
+#define MAGIC_EXT     0xBEEFD00E // Magic number for headers followed by a HeaderExt.
+#define MAGIC_TABLE   0xBEEFD00F // Magic number of shared table files.
 #define MAX_CODE_SIZE (ALPHABET / 8) // Bytes for a maximum, 256-bit code.
 #define MAX_TREE_SIZE (3 * ALPHABET - 1) // Maximum Huffman tree dump size.
+#define MAX_NODES     (2 * ALPHABET - 1) // Maximum nodes in a Huffman tree.
+#define SMALL_FILE    BLOCK // Largest input that may use the built-in text table.
+#define SEEK_BLOCK    (1 << 16) // 64KB blocks of input that can be decoded on their own.
+#define RING_SLOTS    16 // Chunks of output that can wait for the writer thread.
+#define TABLE_BITS    11 // Bits of lookahead in a decoding table.
+#define STREAMS       4 // Interleaved streams per block with FLAG_STREAMS.
+
+#define FLAG_STATIC  0x1 // Codes come from the built-in text table, no tree is dumped.
+#define FLAG_BLOCKS  0x2 // Codes are split into checksummed blocks with a trailing index.
+#define FLAG_CONTEXT 0x4 // Codes use order-1 tables picked by the byte before each symbol.
+#define FLAG_RLE     0x8 // Input was run-length coded before it was Huffman coded.
+#define FLAG_STREAMS 0x10 // Every block is split into STREAMS streams behind a JumpTable.
+#define FLAG_TABLE   0x20 // Codes come from the shared table named in the HeaderExt.
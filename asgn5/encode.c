@@ -1,10 +1,15 @@
 #include "defines.h"
-#include "node.h"
-#include "huffman.h"
-#include "header.h"
+#include "huff.h"
 #include "io.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "histogram.h"
+#include "table.h"
 
+#include <dirent.h>
+#include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -13,13 +18,13 @@
 #include <sys/types.h>
 #include <stdio.h>
 
-#define OPTIONS "hvi:o:"
+#define OPTIONS "hvjpbcszT:t:i:o:"
+
+static struct option long_options[] = { { "train", required_argument, NULL, 'T' },
+    { "table", required_argument, NULL, 't' }, { NULL, 0, NULL, 0 } };
 
 // Used for file permissions
 static struct stat st;
-// Used to keep track of uncompressed/compressed file sizes
-uint64_t bytes_read;
-uint64_t bytes_written;
 
 // Prints out the usage information and then exits the program
 void print_help() {
@@ -27,27 +32,103 @@ void print_help() {
                     "  A Huffman encoder.\n"
                     "  Compresses a file using the Huffman coding algorithm.\n\n"
                     "USAGE\n"
-                    "  ./encode [-h] [-v] [-i infile] [-o outfile]\n\n"
+                    "  ./encode [-h] [-v] [-j] [-p] [-b] [-c] [-s] [-z] [--table table] [-i infile]\n"
+                    "           [-o outfile]\n"
+                    "  ./encode --train corpus [-o table]\n\n"
                     "OPTIONS\n"
                     "  -h             Program usage and help.\n"
                     "  -v             Print compression statistics.\n"
+                    "  -j             Print a JSON profile of the compression.\n"
+                    "  -p             Write the output on a second thread while coding.\n"
+                    "  -b             Checksum 64KB blocks and add a seek index.\n"
+                    "  -c             Code bytes with tables picked by the byte before them.\n"
+                    "  -s             Split each block into 4 interleaved streams.\n"
+                    "  -z             Run-length code long runs of equal bytes first.\n"
+                    "  -T, --train corpus  Train a shared table on a file or a directory of files.\n"
+                    "  -t, --table table   Code the input with a shared table from --train.\n"
                     "  -i infile      Input file to compress.\n"
                     "  -o outfile     Output of compressed data.\n");
     exit(0);
 }
 
-// Prints out the uncompressed and compressed file sizes and the
-// percentage of space saved.
+// Prints out the uncompressed and compressed file sizes, the
+// percentage of space saved, the throughput, and the number of
+// system calls used for I/O.
 //
 // uncompressed_size: size (bytes) of the uncompressed file input
 // compressed_size: size (bytes) of the compressed file output
-void print_stats(uint64_t uncompressed_size, uint64_t compressed_size) {
+// seconds: time taken to compress the file
+void print_stats(uint64_t uncompressed_size, uint64_t compressed_size, double seconds) {
     float space_saving = 100 * (1 - ((double) compressed_size / (double) uncompressed_size));
     fprintf(stderr,
-        "Uncompressed file size: %lu\n"
-        "Compressed file size; %lu\n"
-        "Space saving: %.2f%s\n",
-        uncompressed_size, compressed_size, space_saving, "%");
+        "Uncompressed file size: %" PRIu64 "\n"
+        "Compressed file size; %" PRIu64 "\n"
+        "Space saving: %.2f%s\n"
+        "Throughput: %.2f MB/s\n"
+        "System calls: %" PRIu64 " (read: %" PRIu64 ", write: %" PRIu64 ", mmap: %" PRIu64 ")\n",
+        uncompressed_size, compressed_size, space_saving, "%", uncompressed_size / seconds / 1e6,
+        read_calls + write_calls + map_calls, read_calls, write_calls, map_calls);
+}
+
+// Adds the histogram of the file at path to hist. Returns false if the
+// file cannot be read.
+//
+// path: file to count
+// hist: histogram that the counts are added to
+static bool train_file(const char *path, uint64_t hist[static ALPHABET]) {
+    int fd = open(path, O_RDONLY);
+    Mapping m;
+    if (fd < 0 || !io_map(fd, &m)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    histogram_build(m.data, m.size, hist);
+    io_unmap(&m);
+    close(fd);
+    return true;
+}
+
+// Trains a shared table on corpus, which is either a single file or a
+// directory whose regular files are all counted, and writes the table
+// file to outfile. Exits if the corpus cannot be read.
+//
+// corpus: file or directory to train on
+// outfile: file the table is written to
+static void train(const char *corpus, int outfile) {
+    uint64_t hist[ALPHABET] = { 0 };
+    struct stat info;
+    bool ok = stat(corpus, &info) == 0;
+    if (ok && S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(corpus);
+        struct dirent *entry;
+        char path[PATH_MAX];
+        ok = dir != NULL;
+        while (ok && (entry = readdir(dir)) != NULL) {
+            snprintf(path, sizeof(path), "%s/%s", corpus, entry->d_name);
+            if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+                ok = train_file(path, hist);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    } else if (ok) {
+        ok = train_file(corpus, hist);
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to read %s.\n", corpus);
+        exit(1);
+    }
+
+    SharedTable table;
+    uint8_t buf[TABLE_FILE_SIZE];
+    table_train(&table, hist);
+    if (outfile != STDOUT_FILENO) {
+        fchmod(outfile, 0644);
+    }
+    write_bytes(outfile, buf, table_save(&table, buf));
 }
 
 int main(int argc, char **argv) {
@@ -58,8 +139,13 @@ int main(int argc, char **argv) {
     int outfile = fileno(output);
     bool help = false;
     bool stats = false;
+    bool json = false;
+    bool pipelined = false;
+    uint32_t options = 0;
+    const char *corpus = NULL;
+    SharedTable *shared = NULL;
 
-    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((opt = getopt_long(argc, argv, OPTIONS, long_options, NULL)) != -1) {
         switch (opt) {
         case 'h': help = true; break;
         case 'i':
@@ -67,10 +153,24 @@ int main(int argc, char **argv) {
             fstat(infile, &st);
             break;
         case 'o':
-            outfile = open(optarg, O_WRONLY | O_TRUNC | O_CREAT);
+            outfile = open(optarg, O_RDWR | O_TRUNC | O_CREAT);
             fchmod(outfile, st.st_mode);
             break;
         case 'v': stats = true; break;
+        case 'j': json = true; break;
+        case 'p': pipelined = true; break;
+        case 'b': options |= FLAG_BLOCKS; break;
+        case 'c': options |= FLAG_CONTEXT; break;
+        case 's': options |= FLAG_STREAMS; break;
+        case 'z': options |= FLAG_RLE; break;
+        case 'T': corpus = optarg; break;
+        case 't':
+            shared = (SharedTable *) malloc(sizeof(SharedTable));
+            if (!shared || !table_open(shared, optarg)) {
+                fprintf(stderr, "Failed to load table %s.\n", optarg);
+                exit(1);
+            }
+            break;
         case '?': help = true; break;
         default: help = true; break;
         }
@@ -81,69 +181,71 @@ int main(int argc, char **argv) {
         print_help();
     }
 
-    // Create a histogram of size ALPHABET (256)
-    uint64_t histogram[ALPHABET] = { 0 };
-    uint8_t buf[BLOCK] = { 0 };
-    // Read from infile and increment symbol values in the histogram
-    while (read_bytes(infile, buf, BLOCK) > 0) {
-        for (uint32_t i = 0; i < BLOCK; i += 1) {
-            histogram[buf[i]] += 1;
-        }
+    // Training writes a table instead of compressing anything
+    if (corpus) {
+        train(corpus, outfile);
+        close(outfile);
+        return 0;
     }
 
-    // Minimum two elements in the histogram
-    histogram[0] += 1;
-    histogram[255] += 1;
-
-    // Construct the Huffman Tree
-    Node *root = build_tree(histogram);
+    Profile profile;
+    profile_init(&profile, "encode");
 
-    // Construct a code table by traversing the tree
-    Code table[ALPHABET];
-    build_codes(root, table);
+    // Map the whole input so both passes read it straight from memory
+    Mapping in;
+    if (!io_map(infile, &in)) {
+        fprintf(stderr, "Failed to read input.\n");
+        exit(1);
+    }
 
-    // Keep track of the number of unique symbols
-    uint16_t unique_symbols = 0;
-    for (uint32_t i = 0; i < ALPHABET; i += 1) {
-        if ((histogram[i]) > 0) {
-            unique_symbols += 1;
+    // Compress straight into a regular output file through a mapping,
+    // so that the archive is not held in memory as well. Otherwise
+    // compress into memory, then write the archive out. When pipelined,
+    // a writer thread writes each part of the archive as it is finished.
+    uint64_t size = huff_compress_bound(in.size);
+    Mapping mapped;
+    bool direct = !pipelined && io_map_output(outfile, size, &mapped);
+    uint8_t *out = direct ? mapped.data : (uint8_t *) malloc(size);
+    Pipeline pipeline;
+    HuffSink sink = { .ready = pipeline_ready, .arg = &pipeline };
+    if (!out || (pipelined && !pipeline_start(&pipeline, outfile, out))) {
+        fprintf(stderr, "Failed to allocate %" PRIu64 " bytes.\n", size);
+        exit(1);
+    }
+    if (!huff_encode(in.data, in.size, st.st_mode, options, out, &size, json ? &profile : NULL,
+            pipelined ? &sink : NULL, shared)) {
+        if (direct) {
+            io_unmap_output(outfile, &mapped, 0);
         }
+        fprintf(stderr, "Failed to compress input.\n");
+        exit(1);
     }
-
-    // Set all the fields of header
-    Header header = { .magic = MAGIC,
-        .permissions = st.st_mode,
-        .tree_size = 3 * unique_symbols - 1,
-        .file_size = st.st_size };
-    Header *header_ptr = &header;
-    uint8_t *bytes_ptr = (uint8_t *) header_ptr;
-
-    // Write the header and dump the tree to outfile
-    write_bytes(outfile, bytes_ptr, sizeof(Header));
-    dump_tree(outfile, root);
-
-    // Start from beginning of infile
-    lseek(infile, 0, SEEK_SET);
-    int bytes;
-    // Write all the codes of each input byte to outfile
-    do {
-        bytes = read_bytes(infile, buf, BLOCK);
-        for (int i = 0; i < bytes; i += 1) {
-            write_code(outfile, &table[buf[i]]);
+    if (direct) {
+        io_unmap_output(outfile, &mapped, size);
+    } else if (pipelined) {
+        pipeline_finish(&pipeline, size);
+    } else {
+        io_reserve(outfile, size);
+        for (uint64_t i = 0; i < size; i += IO_BLOCK) {
+            write_bytes(outfile, out + i, size - i < IO_BLOCK ? size - i : IO_BLOCK);
         }
-    } while (bytes > 0);
-
-    // Flush out the rest of the codes
-    flush_codes(outfile);
-
-    // Delete the tree
-    delete_tree(&root);
+    }
+    if (!direct) {
+        free(out);
+    }
+    free(shared);
 
     // Print out file size statistics to stderr
     if (stats) {
-        print_stats(bytes_read / 2, bytes_written);
+        print_stats(in.size, bytes_written, profile_now() - profile.start);
+    }
+    if (json) {
+        profile_print(stderr, &profile);
     }
 
+    // Release the input
+    io_unmap(&in);
+
     // Close the infile and outfile
     close(infile);
     close(outfile);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "defines.h"
+
 #include <stdint.h>
 
 typedef struct {
@@ -8,3 +10,40 @@ typedef struct {
     uint16_t tree_size;
     uint64_t file_size;
 } Header;
+
+// Follows the Header when its magic number is MAGIC_EXT.
+typedef struct {
+    uint32_t flags;
+    uint32_t table; // ID of the shared table with FLAG_TABLE, otherwise 0.
+} HeaderExt;
+
+// Follows the HeaderExt when FLAG_RLE is set. The codes and the block
+// index then describe the run-length coded input, not the original.
+typedef struct {
+    uint64_t size; // Bytes of run-length coded input.
+} RunHeader;
+
+// Starts the codes of every block of archives with FLAG_STREAMS. The
+// symbols of a block are split into STREAMS runs of equal length (the
+// last ones may be shorter), and each run is coded into its own stream
+// starting on a byte boundary. The last stream follows the others and
+// runs to the end of the block.
+typedef struct {
+    uint32_t length[STREAMS - 1]; // Bytes of codes in each stream but the last.
+} JumpTable;
+
+// One entry of the seek index at the end of archives with FLAG_BLOCKS.
+// Block i holds input bytes i * SEEK_BLOCK up to the next block.
+typedef struct {
+    uint64_t offset; // Byte offset of the block's codes from the start of the codes.
+    uint32_t length; // Bytes of codes in the block.
+    uint32_t crc; // CRC32C of the block's uncompressed bytes.
+} BlockIndex;
+
+// Starts a shared table file, written by encode --train. The tree dump
+// follows it.
+typedef struct {
+    uint32_t magic; // MAGIC_TABLE.
+    uint32_t id; // CRC32C of the tree dump.
+    uint32_t tree_size; // Bytes in the tree dump.
+} TableHeader;
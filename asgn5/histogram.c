@@ -0,0 +1,63 @@
+#include "histogram.h"
+#include "defines.h"
+
+#include <string.h>
+
+// Number of interleaved sub-histograms. Consecutive bytes land in
+// different tables so that runs of the same byte do not stall on
+// the increment of a single counter.
+#define LANES 4
+
+// Largest chunk counted before the 32-bit lane counters are folded
+// into the 64-bit histogram. Each lane sees at most a quarter of it.
+#define CHUNK ((size_t) 1 << 30)
+
+// Counts one chunk of at most CHUNK bytes into hist. Eight bytes are
+// loaded at a time and spread across the lanes, then the lanes are
+// summed into the histogram.
+//
+// buf: bytes to count
+// n: number of bytes in buf
+// hist: histogram that the counts are added to
+static void count_chunk(const uint8_t *buf, size_t n, uint64_t hist[static ALPHABET]) {
+    uint32_t lanes[LANES][ALPHABET];
+    memset(lanes, 0, sizeof(lanes));
+
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        memcpy(&word, buf + i, sizeof(word));
+        lanes[0][(uint8_t) word] += 1;
+        lanes[1][(uint8_t) (word >> 8)] += 1;
+        lanes[2][(uint8_t) (word >> 16)] += 1;
+        lanes[3][(uint8_t) (word >> 24)] += 1;
+        lanes[0][(uint8_t) (word >> 32)] += 1;
+        lanes[1][(uint8_t) (word >> 40)] += 1;
+        lanes[2][(uint8_t) (word >> 48)] += 1;
+        lanes[3][(uint8_t) (word >> 56)] += 1;
+    }
+    // Count whatever is left over one byte at a time
+    for (; i < n; i += 1) {
+        lanes[0][buf[i]] += 1;
+    }
+
+    for (uint32_t s = 0; s < ALPHABET; s += 1) {
+        hist[s] += (uint64_t) lanes[0][s] + lanes[1][s] + lanes[2][s] + lanes[3][s];
+    }
+}
+
+// Adds the number of times each symbol appears in buf to hist.
+// hist is not cleared first, so it can be built up over several
+// buffers.
+//
+// buf: bytes to count
+// n: number of bytes in buf
+// hist: histogram that the counts are added to
+void histogram_build(const uint8_t *buf, size_t n, uint64_t hist[static ALPHABET]) {
+    while (n > 0) {
+        size_t len = n < CHUNK ? n : CHUNK;
+        count_chunk(buf, len, hist);
+        buf += len;
+        n -= len;
+    }
+}
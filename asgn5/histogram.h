@@ -0,0 +1,8 @@
+#pragma once
+
+#include "defines.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+void histogram_build(const uint8_t *buf, size_t n, uint64_t hist[static ALPHABET]);
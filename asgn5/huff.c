@@ -0,0 +1,1150 @@
+#include "huff.h"
+#include "code.h"
+#include "context.h"
+#include "crc32c.h"
+#include "defines.h"
+#include "header.h"
+#include "histogram.h"
+#include "huffman.h"
+#include "io.h"
+#include "profile.h"
+#include "rle.h"
+#include "table.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Permissions recorded for data compressed through the library.
+#define DEFAULT_PERMISSIONS 0644
+
+struct HuffStream {
+    uint8_t *data; // Input buffered so far.
+    uint64_t size; // Bytes of buffered input.
+    uint64_t capacity; // Bytes allocated for data.
+    Code static_codes[ALPHABET]; // Codes of the built-in text table, built once.
+};
+
+// Order-1 tables built by the encoder, allocated all together.
+typedef struct {
+    ContextModel model;
+    Code codes[ALPHABET][ALPHABET]; // Code table of each group.
+    uint64_t hist[ALPHABET][ALPHABET]; // Histogram of each context.
+    uint8_t dump[UINT16_MAX]; // Dump of the model.
+} ContextTables;
+
+// How the encoder codes each block.
+typedef struct {
+    Code *table; // Code for each symbol, used without order-1 tables.
+    ContextTables *ctx; // Order-1 tables, or NULL.
+    bool streams; // Whether each block is split into STREAMS streams.
+} Coder;
+
+// Order-1 model read by the decoder, with the decoding table of each
+// of its groups.
+typedef struct {
+    ContextModel model;
+    DecodeTable tables[ALPHABET];
+} ContextDecoder;
+
+// How the decoder decodes each block.
+typedef struct {
+    Tree *trees; // The tree, or the tree of each group of the model.
+    DecodeTable *tables; // Decoding table of each tree.
+    ContextModel *model; // Order-1 model, or NULL.
+    bool streams; // Whether each block is split into STREAMS streams.
+} Decoder;
+
+// Returns the current time if the run is being profiled.
+//
+// p: profile of the run, or NULL
+static double mark(Profile *p) {
+    return p ? profile_now() : 0;
+}
+
+// Adds the time since start to a phase if the run is being profiled.
+//
+// p: profile of the run, or NULL
+// phase: phase that just finished
+// start: time returned by mark() when the phase started
+static void phase(Profile *p, Phase phase, double start) {
+    if (p) {
+        profile_phase(p, phase, start);
+    }
+}
+
+// Tells the sink, if there is one, that the first size bytes of the
+// output are final.
+//
+// sink: sink of the run, or NULL
+// size: bytes at the front of the output that are final
+static void publish(HuffSink *sink, uint64_t size) {
+    if (sink) {
+        sink->ready(sink->arg, size);
+    }
+}
+
+// Returns the number of bits needed to encode every symbol counted in
+// hist with the codes in table.
+//
+// hist: histogram of the input
+// table: code for each symbol
+static uint64_t encoded_bits(uint64_t hist[static ALPHABET], Code table[static ALPHABET]) {
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (hist[i] > 0) {
+            bits += hist[i] * code_size(&table[i]);
+        }
+    }
+    return bits;
+}
+
+// Returns the largest archive that compressing n bytes can produce.
+// A Huffman code never does worse than the fixed 8-bit code, so the
+// coded data is at most n bytes, plus room for the two symbols that
+// are added to every histogram, the header, the largest tree dump, and
+// for every block a byte of padding, an index entry, and a JumpTable
+// with the padding of each of its streams.
+//
+// n: number of bytes to be compressed
+size_t huff_compress_bound(size_t n) {
+    uint64_t blocks = n / SEEK_BLOCK + 1;
+    return sizeof(Header) + sizeof(HeaderExt) + sizeof(RunHeader) + MAX_TREE_SIZE + n + 2
+           + blocks * (1 + sizeof(BlockIndex) + sizeof(JumpTable) + STREAMS);
+}
+
+// Writes the codes of count bytes of src, which start a SEEK_BLOCK or
+// one of its streams. With order-1 tables, each byte is coded with the
+// table of the byte before it, starting from the context 0.
+//
+// w: writer the codes are written to
+// src: bytes to encode
+// count: number of bytes in src, at most SEEK_BLOCK
+// c: how the bytes are coded
+static void encode_symbols(BitWriter *w, const uint8_t *src, uint64_t count, Coder *c) {
+    ContextTables *ctx = c->ctx;
+    if (!ctx) {
+        for (uint64_t i = 0; i < count; i += 1) {
+            write_code(w, &c->table[src[i]]);
+        }
+        return;
+    }
+    uint8_t prev = 0;
+    for (uint64_t i = 0; i < count; i += 1) {
+        write_code(w, &ctx->codes[ctx->model.map[prev]][src[i]]);
+        prev = src[i];
+    }
+}
+
+// Writes the codes of one SEEK_BLOCK of src. Split blocks start on a
+// byte boundary with a JumpTable, followed by the codes of each stream
+// padded to a byte boundary, so that the writer ends on one as well.
+//
+// w: writer the codes are written to
+// src: bytes to encode
+// count: number of bytes in src, at most SEEK_BLOCK
+// c: how the bytes are coded
+static void encode_block(BitWriter *w, const uint8_t *src, uint64_t count, Coder *c) {
+    if (!c->streams) {
+        encode_symbols(w, src, count, c);
+        return;
+    }
+    JumpTable jump;
+    uint64_t at = w->index / 8;
+    w->index += 8 * sizeof(JumpTable);
+    uint64_t length = (count + STREAMS - 1) / STREAMS;
+    for (uint32_t k = 0; k < STREAMS; k += 1) {
+        uint64_t first = k * length < count ? k * length : count;
+        uint64_t end = count - first < length ? count : first + length;
+        uint64_t start = w->index;
+        encode_symbols(w, src + first, end - first, c);
+        w->index = (w->index + 7) / 8 * 8;
+        if (k < STREAMS - 1) {
+            jump.length[k] = (w->index - start) / 8;
+        }
+    }
+    memcpy(w->data + at, &jump, sizeof(JumpTable));
+}
+
+// Encodes src in blocks of SEEK_BLOCK bytes. The codes of each block
+// start on a byte boundary so that the block can be decoded on its
+// own, and an index entry with the block's location and the CRC32C of
+// its input is written for it. The index is first built at the end of
+// the space for the archive and then moved down to follow the codes.
+// Returns the number of bytes written, codes and index together.
+//
+// src: bytes to encode
+// n: number of bytes in src
+// c: how the bytes are coded
+// dst: codes and index are written here
+// size: bytes of space in dst
+// sink: told as each block is finished, or NULL
+// base: offset of dst in the output, for the sink
+static uint64_t encode_blocks(const uint8_t *src, uint64_t n, Coder *c, uint8_t *dst,
+    uint64_t size, HuffSink *sink, uint64_t base) {
+    uint64_t blocks = (n + SEEK_BLOCK - 1) / SEEK_BLOCK;
+    uint64_t index_size = blocks * sizeof(BlockIndex);
+    uint8_t *index = dst + size - index_size;
+    uint64_t offset = 0;
+    for (uint64_t b = 0; b < blocks; b += 1) {
+        uint64_t first = b * SEEK_BLOCK;
+        uint64_t count = n - first < SEEK_BLOCK ? n - first : SEEK_BLOCK;
+        BitWriter w = { .data = dst + offset, .size = size - index_size - offset, .index = 0 };
+        encode_block(&w, src + first, count, c);
+        BlockIndex entry
+            = { .offset = offset, .length = flush_codes(&w), .crc = crc32c(0, src + first, count) };
+        memcpy(index + b * sizeof(BlockIndex), &entry, sizeof(BlockIndex));
+        offset += entry.length;
+        publish(sink, base + offset);
+    }
+    memmove(dst + offset, index, index_size);
+    return offset + index_size;
+}
+
+// Builds order-1 tables for src into ctx, with the code tables of
+// every group and the dump of the model. Returns the number of bits
+// that coding src with them takes.
+//
+// src: bytes to be encoded
+// n: number of bytes in src
+// streams: number of streams per block, 1 if blocks are not split
+// ctx: tables that are built
+// p: profile of the run, or NULL
+static uint64_t build_context(
+    const uint8_t *src, uint64_t n, uint32_t streams, ContextTables *ctx, Profile *p) {
+    double start = mark(p);
+    memset(ctx->hist, 0, sizeof(ctx->hist));
+    context_histogram(src, n, streams, ctx->hist);
+    phase(p, HISTOGRAM, start);
+
+    start = mark(p);
+    context_build(&ctx->model, ctx->hist);
+    phase(p, TREE, start);
+
+    start = mark(p);
+    uint64_t bits = 0;
+    for (uint32_t g = 0; g < ctx->model.groups; g += 1) {
+        build_codes(&ctx->model.trees[g], ctx->codes[g]);
+    }
+    for (uint32_t c = 0; c < ALPHABET; c += 1) {
+        bits += encoded_bits(ctx->hist[c], ctx->codes[ctx->model.map[c]]);
+    }
+    phase(p, CODES, start);
+    return bits;
+}
+
+// Returns the number of bytes before the tree dump of an archive.
+//
+// h: header of the archive
+// ext: extended header of the archive
+static uint64_t header_size(Header *h, HeaderExt *ext) {
+    if (h->magic != MAGIC_EXT) {
+        return sizeof(Header);
+    }
+    return sizeof(Header) + sizeof(HeaderExt) + ((ext->flags & FLAG_RLE) ? sizeof(RunHeader) : 0);
+}
+
+// Sets symbols to the number of symbols Huffman coded into an archive,
+// which are the runs of a run-length coded archive and otherwise the
+// bytes of the original data. Returns false if the archive is too
+// short to hold that many codes, since every code takes at least a bit.
+//
+// src: archive, with its headers already read
+// n: number of bytes in src
+// h: header of the archive
+// ext: extended header of the archive
+// symbols: the number of coded symbols is stored here
+static bool coded_symbols(
+    const uint8_t *src, uint64_t n, Header *h, HeaderExt *ext, uint64_t *symbols) {
+    *symbols = h->file_size;
+    if (ext->flags & FLAG_RLE) {
+        RunHeader run_header;
+        memcpy(&run_header, src + sizeof(Header) + sizeof(HeaderExt), sizeof(RunHeader));
+        *symbols = run_header.size;
+    }
+    uint64_t offset = header_size(h, ext);
+    if (!(ext->flags & (FLAG_STATIC | FLAG_TABLE))) {
+        offset += h->tree_size;
+    }
+    return offset <= n && *symbols / 8 <= n - offset;
+}
+
+// How encode_with() codes one stream of symbols, and what it costs.
+typedef struct {
+    uint32_t flags; // FLAG_TABLE, FLAG_STATIC, or FLAG_CONTEXT if one was chosen.
+    uint64_t histogram[ALPHABET]; // Histogram of the stream.
+    Code codes[ALPHABET]; // Codes of the tree built for the stream.
+    Code *table; // Codes the stream is coded with.
+    Tree tree; // Tree built for the stream.
+    uint8_t tree_dump[MAX_TREE_SIZE]; // Dump of the tree.
+    uint8_t *dump; // Dump written after the header, tree_dump or the order-1 dump.
+    uint16_t tree_size; // Bytes in dump.
+    uint64_t bits; // Bits of all the codes of the stream.
+    ContextTables *ctx; // Order-1 tables, or NULL.
+    Profile times; // Time spent on the plan, if the run is profiled.
+} Plan;
+
+// Starts timing an attempt at a table on a profile of its own, so that
+// the time can be counted as rejected if the table is not used.
+// Returns the profile to time the attempt with, or NULL if the run is
+// not profiled.
+//
+// p: profile of the run, or NULL
+// trial: profile that the attempt is timed with
+static Profile *trial_start(Profile *p, Profile *trial) {
+    if (!p) {
+        return NULL;
+    }
+    memset(trial->seconds, 0, sizeof(trial->seconds));
+    return trial;
+}
+
+// Adds the times of a finished attempt to their phases in t, or all of
+// them to REJECTED if its table is not used.
+//
+// t: profile the times are added to, or NULL if the run is not profiled
+// trial: times of the attempt
+// used: whether the table of the attempt is used
+static void trial_end(Profile *t, Profile *trial, bool used) {
+    if (t) {
+        for (uint32_t i = 0; i < PHASES; i += 1) {
+            t->seconds[used ? i : REJECTED] += trial->seconds[i];
+        }
+    }
+}
+
+// Chooses the codes of n bytes of src: the shared table or the built-in
+// text table if they do not expand the input, otherwise a tree of its
+// own, replaced by order-1 tables if those are smaller. Returns false
+// if the order-1 tables cannot be allocated.
+//
+// src: bytes to be encoded
+// n: number of bytes in src
+// flags: FLAG_STREAMS if blocks are split into streams
+// options: FLAG_CONTEXT to try order-1 tables
+// shared: table to code the input with instead of a tree of its own, or NULL
+// static_codes: codes of the built-in text table, or NULL to build them
+// plan: filled in with the chosen codes and their cost, and with the
+//       time they took if the run is profiled
+// p: profile of the run, or NULL
+static bool plan_codes(const uint8_t *src, uint64_t n, uint32_t flags, uint32_t options,
+    SharedTable *shared, Code *static_codes, Plan *plan, Profile *p) {
+    // Tables that are built and then not used are timed as rejected
+    Profile *t = trial_start(p, &plan->times);
+    Profile trial;
+    Profile *tt = NULL;
+
+    // Create a histogram of size ALPHABET (256)
+    double start = mark(t);
+    memset(plan->histogram, 0, sizeof(plan->histogram));
+    histogram_build(src, n, plan->histogram);
+    phase(t, HISTOGRAM, start);
+
+    uint64_t *histogram = plan->histogram;
+    plan->flags = 0;
+    plan->table = plan->codes;
+    plan->dump = plan->tree_dump;
+    plan->tree_size = 0;
+    plan->ctx = NULL;
+
+    // A shared table is used as long as it does not expand the input,
+    // which saves building and dumping a tree for it
+    if (shared && encoded_bits(histogram, shared->codes) < 8 * n) {
+        plan->flags |= FLAG_TABLE;
+        plan->table = shared->codes;
+    }
+
+    // Small inputs use the built-in text table as long as it does not
+    // expand them, which saves building and dumping a tree of their own
+    if (n <= SMALL_FILE && !(plan->flags & FLAG_TABLE)) {
+        tt = trial_start(p, &trial);
+        if (!static_codes) {
+            start = mark(tt);
+            default_tree(&plan->tree);
+            phase(tt, TREE, start);
+            start = mark(tt);
+            build_codes(&plan->tree, plan->codes);
+            phase(tt, CODES, start);
+            static_codes = plan->codes;
+        }
+        if (encoded_bits(histogram, static_codes) < 8 * n) {
+            plan->flags |= FLAG_STATIC;
+            plan->table = static_codes;
+        }
+        trial_end(t, tt, plan->flags & FLAG_STATIC);
+    }
+
+    // The time of the tree is kept apart until the order-1 tables have
+    // been tried
+    tt = trial_start(p, &trial);
+    if (!(plan->flags & (FLAG_STATIC | FLAG_TABLE))) {
+        // Minimum two elements in the histogram
+        histogram[0] += 1;
+        histogram[255] += 1;
+
+        // Construct the Huffman Tree
+        start = mark(tt);
+        build_tree(&plan->tree, histogram);
+        phase(tt, TREE, start);
+
+        // Construct a code table by traversing the tree
+        start = mark(tt);
+        build_codes(&plan->tree, plan->codes);
+        plan->table = plan->codes;
+        plan->tree_size = dump_tree(&plan->tree, plan->tree_dump);
+        phase(tt, CODES, start);
+
+        histogram[0] -= 1;
+        histogram[255] -= 1;
+    }
+    plan->bits = encoded_bits(histogram, plan->table);
+
+    // Order-1 tables replace the tree if they shrink the archive even
+    // after their larger dump is paid for
+    if ((options & FLAG_CONTEXT) && !(plan->flags & (FLAG_STATIC | FLAG_TABLE))) {
+        ContextTables *ctx = (ContextTables *) malloc(sizeof(ContextTables));
+        if (!ctx) {
+            return false;
+        }
+        Profile context_trial;
+        Profile *ct = trial_start(p, &context_trial);
+        uint64_t context_bits
+            = build_context(src, n, (flags & FLAG_STREAMS) ? STREAMS : 1, ctx, ct);
+        uint32_t context_size = context_dump(&ctx->model, ctx->dump);
+        if (8 * context_size + context_bits < 8 * plan->tree_size + plan->bits) {
+            plan->flags |= FLAG_CONTEXT;
+            plan->dump = ctx->dump;
+            plan->tree_size = context_size;
+            plan->bits = context_bits;
+            plan->ctx = ctx;
+        } else {
+            free(ctx);
+        }
+        trial_end(t, ct, plan->flags & FLAG_CONTEXT);
+    }
+    trial_end(t, tt, !(plan->flags & FLAG_CONTEXT));
+    return true;
+}
+
+// Returns the largest size an archive of n symbols coded as planned
+// can have: its headers, the dump, the codes, and with split blocks
+// their index and the JumpTable and padding of each stream.
+//
+// flags: flags of the archive
+// plan: codes of the symbols
+// n: number of symbols
+static uint64_t archive_size(uint32_t flags, Plan *plan, uint64_t n) {
+    Header header = { .magic = flags ? MAGIC_EXT : MAGIC };
+    HeaderExt ext = { .flags = flags };
+    uint64_t chunks = (n + SEEK_BLOCK - 1) / SEEK_BLOCK;
+    uint64_t blocks = (flags & FLAG_BLOCKS) ? chunks : 0;
+    uint64_t total = header_size(&header, &ext) + plan->tree_size + (plan->bits + 7) / 8
+                     + blocks * (1 + sizeof(BlockIndex));
+    if (flags & FLAG_STREAMS) {
+        total += chunks * (sizeof(JumpTable) + STREAMS);
+    }
+    return total;
+}
+
+// Compresses n bytes of src into an archive in dst. This does the
+// work for the library and the encode program.
+//
+// src: bytes to compress
+// n: number of bytes in src
+// permissions: file permissions recorded in the header
+// options: FLAG_BLOCKS to split the codes into indexed blocks,
+//          FLAG_STREAMS to split each block into interleaved streams,
+//          FLAG_CONTEXT to try order-1 tables, and FLAG_RLE to try
+//          run-length coding the input first
+// dst: archive is written here
+// dst_len: capacity of dst, set to the size of the archive
+// p: filled in with a profile of the run if not NULL
+// sink: told as the archive is finished, or NULL
+// shared: table to code the input with instead of a tree of its own, or NULL
+// static_codes: codes of the built-in text table, or NULL to build them
+static bool encode_with(const uint8_t *src, uint64_t n, uint16_t permissions, uint32_t options,
+    uint8_t *dst, uint64_t *dst_len, Profile *p, HuffSink *sink, SharedTable *shared,
+    Code *static_codes) {
+    uint32_t flags = options & (FLAG_BLOCKS | FLAG_STREAMS);
+    uint64_t file_size = n;
+
+    Plan plans[2];
+    Plan *plan = &plans[0];
+    if (!plan_codes(src, n, flags, options, shared, static_codes, plan, p)) {
+        return false;
+    }
+
+    // Code the runs instead of the input if that makes the whole
+    // archive smaller, after the run header and the codes of the runs
+    // are paid for
+    uint8_t *runs = NULL;
+    Profile rle;
+    Profile *rt = trial_start(p, &rle);
+    if ((options & FLAG_RLE) && n > 0) {
+        double start = mark(rt);
+        uint64_t size = n - 1;
+        if (!(runs = (uint8_t *) malloc(n))) {
+            free(plan->ctx);
+            return false;
+        }
+        bool shrunk = rle_encode(src, n, runs, &size);
+        phase(rt, HISTOGRAM, start);
+        if (shrunk) {
+            if (!plan_codes(runs, size, flags, options, shared, static_codes, &plans[1], p)) {
+                free(plan->ctx);
+                free(runs);
+                return false;
+            }
+            if (archive_size(flags | FLAG_RLE | plans[1].flags, &plans[1], size)
+                < archive_size(flags | plan->flags, plan, n)) {
+                free(plan->ctx);
+                plan = &plans[1];
+                flags |= FLAG_RLE;
+                src = runs;
+                n = size;
+            } else {
+                free(plans[1].ctx);
+            }
+            trial_end(p, &plans[1].times, flags & FLAG_RLE);
+        }
+        if (!(flags & FLAG_RLE)) {
+            free(runs);
+            runs = NULL;
+        }
+    }
+    // Only the time of the plan that is used counts toward its phases
+    trial_end(p, rt, flags & FLAG_RLE);
+    trial_end(p, &plans[0].times, !(flags & FLAG_RLE));
+    flags |= plan->flags;
+    Code *table = plan->table;
+    ContextTables *ctx = plan->ctx;
+    uint16_t tree_size = plan->tree_size;
+    uint64_t bits = plan->bits;
+
+    // Set all the fields of header. Plain archives keep the original
+    // header, anything else is marked by MAGIC_EXT and a HeaderExt.
+    Header header = { .magic = flags ? MAGIC_EXT : MAGIC,
+        .permissions = permissions,
+        .tree_size = tree_size,
+        .file_size = file_size };
+    HeaderExt ext = { .flags = flags, .table = (flags & FLAG_TABLE) ? shared->id : 0 };
+    RunHeader run_header = { .size = n };
+    uint64_t prefix = header_size(&header, &ext);
+
+    // Make sure the whole archive fits before writing any of it
+    uint64_t blocks = (flags & FLAG_BLOCKS) ? (n + SEEK_BLOCK - 1) / SEEK_BLOCK : 0;
+    uint64_t total = archive_size(flags, plan, n);
+    if (total > *dst_len) {
+        free(ctx);
+        free(runs);
+        return false;
+    }
+
+    // Write the header and the tree dump
+    memcpy(dst, &header, sizeof(Header));
+    if (flags) {
+        memcpy(dst + sizeof(Header), &ext, sizeof(HeaderExt));
+    }
+    if (flags & FLAG_RLE) {
+        memcpy(dst + sizeof(Header) + sizeof(HeaderExt), &run_header, sizeof(RunHeader));
+    }
+    memcpy(dst + prefix, plan->dump, tree_size);
+    publish(sink, prefix + tree_size);
+
+    // Write all the codes of each input byte
+    double start = mark(p);
+    uint8_t *codes = dst + prefix + tree_size;
+    uint64_t space = total - prefix - tree_size;
+    Coder coder = { .table = table, .ctx = ctx, .streams = flags & FLAG_STREAMS };
+    if (flags & FLAG_BLOCKS) {
+        *dst_len = prefix + tree_size
+                   + encode_blocks(src, n, &coder, codes, space, sink, prefix + tree_size);
+    } else {
+        BitWriter w = { .data = codes, .size = space, .index = 0 };
+        for (uint64_t first = 0; first < n; first += SEEK_BLOCK) {
+            uint64_t count = n - first < SEEK_BLOCK ? n - first : SEEK_BLOCK;
+            encode_block(&w, src + first, count, &coder);
+            // Only the byte holding the last bit can still change
+            publish(sink, prefix + tree_size + w.index / 8);
+        }
+        *dst_len = prefix + tree_size + flush_codes(&w);
+    }
+    publish(sink, *dst_len);
+    phase(p, CODING, start);
+
+    if (p) {
+        p->mode = (flags & FLAG_STATIC) ? "static"
+                  : (flags & FLAG_TABLE)   ? "table"
+                  : (flags & FLAG_CONTEXT) ? "context"
+                                           : "dynamic";
+        p->input_size = file_size;
+        p->output_size = *dst_len;
+        p->blocks = blocks;
+        p->symbols = n;
+        p->coded_bits = bits;
+        p->entropy = entropy(plan->histogram);
+        if (blocks) {
+            profile_blocks(p, src, n);
+        }
+        p->tree_depth = ctx ? context_depth(&ctx->model)
+                        : table == plan->codes ? tree_depth(&plan->tree)
+                        : (flags & FLAG_TABLE) ? tree_depth(&shared->tree)
+                                               : 0;
+        for (uint32_t i = 0; i < ALPHABET; i += 1) {
+            p->unique_symbols += plan->histogram[i] > 0;
+        }
+    }
+    free(ctx);
+    free(runs);
+    return true;
+}
+
+// Compresses n bytes of src into an archive in dst, in the same
+// format as the encode program. Returns false if dst is too small.
+//
+// src: bytes to compress
+// n: number of bytes in src
+// permissions: file permissions recorded in the header
+// options: FLAG_BLOCKS to split the codes into indexed blocks, or 0
+// dst: archive is written here
+// dst_len: capacity of dst, set to the size of the archive
+// p: filled in with a profile of the run if not NULL
+// sink: told as the front of the archive is finished, or NULL
+// shared: table to code the input with instead of a tree of its own, or NULL
+bool huff_encode(const uint8_t *src, uint64_t n, uint16_t permissions, uint32_t options,
+    uint8_t *dst, uint64_t *dst_len, Profile *p, HuffSink *sink, SharedTable *shared) {
+    return encode_with(src, n, permissions, options, dst, dst_len, p, sink, shared, NULL);
+}
+
+// Compresses n bytes of src into dst. dst_len holds the capacity of
+// dst and is set to the size of the compressed data. Returns false if
+// dst is too small; huff_compress_bound() is always large enough.
+//
+// src: bytes to compress
+// n: number of bytes in src
+// dst: compressed data is written here
+// dst_len: capacity of dst, set to the size of the compressed data
+bool huff_compress(const void *src, size_t n, void *dst, size_t *dst_len) {
+    uint64_t len = *dst_len;
+    bool ok = encode_with(src, n, DEFAULT_PERMISSIONS, 0, dst, &len, NULL, NULL, NULL, NULL);
+    *dst_len = len;
+    return ok;
+}
+
+// Reads the header of an archive, and the extended header if there
+// is one. Returns false if src is too short for them or the magic
+// number is invalid.
+//
+// src: archive
+// n: number of bytes in src
+// h: the header is stored here
+// ext: the extended header is stored here, or cleared if there is none
+bool huff_read_header(const uint8_t *src, uint64_t n, Header *h, HeaderExt *ext) {
+    memset(ext, 0, sizeof(HeaderExt));
+    if (n < sizeof(Header)) {
+        return false;
+    }
+    memcpy(h, src, sizeof(Header));
+    if (h->magic == MAGIC_EXT) {
+        if (n < sizeof(Header) + sizeof(HeaderExt)) {
+            return false;
+        }
+        memcpy(ext, src + sizeof(Header), sizeof(HeaderExt));
+        return n >= header_size(h, ext);
+    }
+    return h->magic == MAGIC;
+}
+
+// Sets size to the number of bytes that decompressing src produces.
+// Returns false if src is not an archive, or if it is too short for
+// the size in its header, so that the size can be trusted enough to
+// allocate. Run-length coded archives are only checked for the number
+// of runs, as a few runs can expand to any size.
+//
+// src: compressed data
+// n: number of bytes in src
+// size: the decompressed size is stored here
+bool huff_content_size(const void *src, size_t n, uint64_t *size) {
+    Header h;
+    HeaderExt ext;
+    uint64_t symbols;
+    if (!huff_read_header(src, n, &h, &ext) || !coded_symbols(src, n, &h, &ext, &symbols)) {
+        return false;
+    }
+    *size = h.file_size;
+    return true;
+}
+
+// Returns the next 57 or more bits of r without consuming them, the
+// next bit lowest. Bits past the end of r read as 0.
+//
+// r: bits to peek at
+static inline uint64_t peek_bits(BitReader *r) {
+    uint64_t byte = r->index / 8;
+    uint64_t bits = 0;
+    if (byte + sizeof(bits) <= r->size) {
+        memcpy(&bits, r->data + byte, sizeof(bits));
+    } else {
+        for (uint64_t i = 0; byte + i < r->size; i += 1) {
+            bits |= (uint64_t) r->data[byte + i] << (8 * i);
+        }
+    }
+    return bits >> (r->index % 8);
+}
+
+// Decodes one symbol from r. Codes of up to TABLE_BITS bits are looked
+// up in the decoding table all at once, and longer codes are decoded
+// by walking the tree a bit at a time. Returns false if r runs out of
+// bits first.
+//
+// t: tree of the code
+// d: decoding table of the tree
+// r: bits to decode
+// symbol: the decoded symbol is passed back with this
+static inline bool decode_one(Tree *t, DecodeTable *d, BitReader *r, uint8_t *symbol) {
+    uint16_t entry = d->entries[peek_bits(r) & ((1 << TABLE_BITS) - 1)];
+    uint32_t len = entry >> 8;
+    if (len > 0 && r->index + len <= 8 * r->size) {
+        *symbol = entry;
+        r->index += len;
+        return true;
+    }
+    uint8_t bit = 0;
+    uint16_t current = t->root;
+    // Walk down from the root until a leaf is reached
+    while (t->nodes[current].left != NO_NODE) {
+        if (!read_bit(r, &bit)) {
+            return false;
+        }
+        current = bit == 0 ? t->nodes[current].left : t->nodes[current].right;
+    }
+    *symbol = t->nodes[current].symbol;
+    return true;
+}
+
+// Decodes count symbols that start a SEEK_BLOCK or one of its streams.
+// With an order-1 model, each symbol is decoded with the tree of the
+// byte before it, starting from the context 0. Returns false if r runs
+// out of bits first.
+//
+// d: how the symbols are decoded
+// r: bits to decode
+// dst: decoded symbols are written here
+// count: number of symbols to decode
+static bool decode_symbols(Decoder *d, BitReader *r, uint8_t *dst, uint64_t count) {
+    uint8_t prev = 0;
+    for (uint64_t i = 0; i < count; i += 1) {
+        uint32_t g = d->model ? d->model->map[prev] : 0;
+        if (!decode_one(&d->trees[g], &d->tables[g], r, &dst[i])) {
+            return false;
+        }
+        prev = dst[i];
+    }
+    return true;
+}
+
+// Decodes the STREAMS streams of a split block together, one symbol
+// from each stream per step, so that the CPU can work on all of them
+// at once instead of waiting on one code to find the next. Returns
+// false if a stream runs out of bits first.
+//
+// d: how the symbols are decoded
+// r: bits of each stream
+// dst: decoded symbols are written here
+// count: number of symbols in the block
+static bool decode_streams(Decoder *d, BitReader r[static STREAMS], uint8_t *dst, uint64_t count) {
+    uint64_t length = (count + STREAMS - 1) / STREAMS;
+    uint64_t first[STREAMS];
+    uint64_t end[STREAMS];
+    for (uint32_t k = 0; k < STREAMS; k += 1) {
+        first[k] = k * length < count ? k * length : count;
+        end[k] = count - first[k] < length ? count : first[k] + length;
+    }
+    // The last stream is the shortest, so every stream has its symbols
+    uint64_t common = end[STREAMS - 1] - first[STREAMS - 1];
+    uint8_t prev[STREAMS] = { 0 };
+    bool ok = true;
+    for (uint64_t i = 0; i < common; i += 1) {
+        for (uint32_t k = 0; k < STREAMS; k += 1) {
+            uint32_t g = d->model ? d->model->map[prev[k]] : 0;
+            ok &= decode_one(&d->trees[g], &d->tables[g], &r[k], &dst[first[k] + i]);
+            prev[k] = dst[first[k] + i];
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    // Then the rest of the longer streams one at a time
+    for (uint32_t k = 0; k < STREAMS; k += 1) {
+        for (uint64_t i = first[k] + common; i < end[k]; i += 1) {
+            uint32_t g = d->model ? d->model->map[prev[k]] : 0;
+            if (!decode_one(&d->trees[g], &d->tables[g], &r[k], &dst[i])) {
+                return false;
+            }
+            prev[k] = dst[i];
+        }
+    }
+    return true;
+}
+
+// Decodes the count symbols of one SEEK_BLOCK. A split block starts
+// on a byte boundary with its JumpTable, and r is left on the byte
+// after the last of its streams. Returns false if the block is
+// truncated or corrupted.
+//
+// d: how the symbols are decoded
+// r: bits of the block and anything after it
+// dst: decoded symbols are written here
+// count: number of symbols in the block
+static bool decode_block(Decoder *d, BitReader *r, uint8_t *dst, uint64_t count) {
+    if (!d->streams) {
+        return decode_symbols(d, r, dst, count);
+    }
+    uint64_t at = r->index / 8;
+    JumpTable jump;
+    if (at > r->size || r->size - at < sizeof(JumpTable)) {
+        return false;
+    }
+    memcpy(&jump, r->data + at, sizeof(JumpTable));
+    at += sizeof(JumpTable);
+    BitReader streams[STREAMS];
+    for (uint32_t k = 0; k < STREAMS; k += 1) {
+        uint64_t length = k < STREAMS - 1 ? jump.length[k] : r->size - at;
+        if (length > r->size - at) {
+            return false;
+        }
+        streams[k] = (BitReader) { .data = r->data + at, .size = length, .index = 0 };
+        at += length;
+    }
+    if (!decode_streams(d, streams, dst, count)) {
+        return false;
+    }
+    BitReader *last = &streams[STREAMS - 1];
+    r->index = 8 * (last->data - r->data) + (last->index + 7) / 8 * 8;
+    return true;
+}
+
+// Decompresses length bytes starting at byte from of the original
+// data from the archive in src. Archives with a block index only have
+// the blocks that overlap the range decoded, and every decoded block
+// is checked against its CRC32C. Other archives are decoded from the
+// start up to the end of the range. Blocks that lie entirely inside
+// the range are decoded straight into dst. A range starting past the
+// end of the data is empty. Returns false if the archive is invalid
+// or corrupted, or if dst is too small.
+//
+// src: archive
+// n: number of bytes in src
+// from: offset of the first byte to decompress
+// length: number of bytes to decompress, clamped to the end of the data
+// dst: decompressed data is written here
+// dst_len: capacity of dst, set to the number of bytes decompressed
+// p: filled in with a profile of the run if not NULL
+// sink: told as the front of dst is finished, or NULL
+// shared: table the archive was coded with, or NULL
+bool huff_decode_range(const uint8_t *src, uint64_t n, uint64_t from, uint64_t length,
+    uint8_t *dst, uint64_t *dst_len, Profile *p, HuffSink *sink, SharedTable *shared) {
+    Header header;
+    HeaderExt ext;
+    uint64_t symbols;
+    if (!huff_read_header(src, n, &header, &ext)
+        || !coded_symbols(src, n, &header, &ext, &symbols)) {
+        return false;
+    }
+    if (from > 0 && from >= header.file_size) {
+        *dst_len = 0;
+        return true;
+    }
+    length = header.file_size - from < length ? header.file_size - from : length;
+    if (length > *dst_len) {
+        return false;
+    }
+    uint64_t offset = header_size(&header, &ext);
+
+    // Run-length coded archives have all of their runs decoded first,
+    // and the range is then expanded from them
+    uint64_t end = from + length;
+    uint64_t expand_from = from;
+    uint8_t *runs = NULL;
+    uint8_t *target = dst;
+    if (ext.flags & FLAG_RLE) {
+        if (!(runs = (uint8_t *) malloc(symbols ? symbols : 1))) {
+            return false;
+        }
+        target = runs;
+        from = 0;
+        end = symbols;
+    }
+
+    double start = mark(p);
+    Tree tree;
+    DecodeTable table;
+    ContextDecoder *context = NULL;
+    if (ext.flags & FLAG_TABLE) {
+        // Encoded with a shared table, which has to be the one it names
+        if (!shared || shared->id != ext.table) {
+            free(runs);
+            return false;
+        }
+    } else if (ext.flags & FLAG_STATIC) {
+        // Encoded with the built-in text table, so no tree was dumped
+        default_tree(&tree);
+    } else if (ext.flags & FLAG_CONTEXT) {
+        // Rebuild the order-1 tables from their dump
+        context = (ContextDecoder *) malloc(sizeof(ContextDecoder));
+        if (!context || offset + header.tree_size > n
+            || !context_rebuild(&context->model, header.tree_size, src + offset)) {
+            free(context);
+            free(runs);
+            return false;
+        }
+        offset += header.tree_size;
+    } else {
+        // Reconstruct the Huffman tree from the dump
+        if (offset + header.tree_size > n
+            || !rebuild_tree(&tree, header.tree_size, src + offset)) {
+            free(runs);
+            return false;
+        }
+        offset += header.tree_size;
+    }
+
+    // Build a decoding table for every tree
+    Decoder decoder = { .trees = &tree,
+        .tables = &table,
+        .model = context ? &context->model : NULL,
+        .streams = ext.flags & FLAG_STREAMS };
+    if (context) {
+        decoder.trees = context->model.trees;
+        decoder.tables = context->tables;
+    }
+    if (ext.flags & FLAG_TABLE) {
+        // The shared table comes with its decoding table already built
+        decoder.trees = &shared->tree;
+        decoder.tables = &shared->decode;
+    } else {
+        for (uint32_t g = 0; g < (context ? context->model.groups : 1); g += 1) {
+            build_table(&decoder.trees[g], &decoder.tables[g]);
+        }
+    }
+    phase(p, TREE, start);
+
+    // Find the codes, and the index that follows them
+    bool indexed = ext.flags & FLAG_BLOCKS;
+    uint64_t blocks = indexed ? (symbols + SEEK_BLOCK - 1) / SEEK_BLOCK : 0;
+    if (n - offset < blocks * sizeof(BlockIndex)) {
+        free(context);
+        free(runs);
+        return false;
+    }
+    const uint8_t *codes = src + offset;
+    uint64_t codes_size = n - offset - blocks * sizeof(BlockIndex);
+    const uint8_t *index = codes + codes_size;
+
+    // Traverse the tree using the codes to decompress the range
+    start = mark(p);
+    uint8_t *scratch = NULL;
+    bool ok = true;
+    BitReader r = { .data = codes, .size = codes_size, .index = 0 };
+    for (uint64_t b = indexed ? from / SEEK_BLOCK : 0; ok && b * SEEK_BLOCK < end; b += 1) {
+        uint64_t first = b * SEEK_BLOCK;
+        uint64_t count = symbols - first < SEEK_BLOCK ? symbols - first : SEEK_BLOCK;
+        BlockIndex entry;
+        if (indexed) {
+            // Each indexed block has codes of its own
+            memcpy(&entry, index + b * sizeof(BlockIndex), sizeof(BlockIndex));
+            if (entry.offset > codes_size || entry.length > codes_size - entry.offset) {
+                ok = false;
+                break;
+            }
+            r.data = codes + entry.offset;
+            r.size = entry.length;
+            r.index = 0;
+        }
+        // Blocks that only partly overlap the range go through scratch
+        uint8_t *out = scratch;
+        if (first >= from && first + count <= end) {
+            out = target + (first - from);
+        } else if (!scratch && !(out = scratch = (uint8_t *) malloc(SEEK_BLOCK))) {
+            ok = false;
+            break;
+        }
+        ok = decode_block(&decoder, &r, out, count);
+        if (ok && indexed) {
+            ok = crc32c(0, out, count) == entry.crc;
+        }
+        if (ok && out == scratch && first + count > from) {
+            uint64_t lo = first > from ? first : from;
+            uint64_t hi = first + count < end ? first + count : end;
+            memcpy(target + (lo - from), scratch + (lo - first), hi - lo);
+        }
+        if (ok && !runs && first + count > from) {
+            publish(sink, (first + count < end ? first + count : end) - from);
+        }
+    }
+    free(scratch);
+    if (ok && runs) {
+        ok = rle_decode(runs, symbols, dst, expand_from, expand_from + length);
+    }
+    free(runs);
+    if (!ok) {
+        free(context);
+        return false;
+    }
+    *dst_len = length;
+    publish(sink, length);
+    phase(p, CODING, start);
+
+    if (p) {
+        uint64_t histogram[ALPHABET] = { 0 };
+        histogram_build(dst, length, histogram);
+        p->mode = (ext.flags & FLAG_STATIC) ? "static"
+                  : (ext.flags & FLAG_TABLE)   ? "table"
+                  : (ext.flags & FLAG_CONTEXT) ? "context"
+                                               : "dynamic";
+        p->input_size = n;
+        p->output_size = length;
+        p->symbols = (ext.flags & FLAG_RLE) ? symbols : length;
+        p->coded_bits = length == header.file_size ? 8 * codes_size : 0;
+        p->blocks = blocks;
+        p->entropy = entropy(histogram);
+        if (blocks) {
+            profile_blocks(p, dst, length);
+        }
+        p->tree_depth = context ? context_depth(&context->model) : tree_depth(decoder.trees);
+        for (uint32_t i = 0; i < ALPHABET; i += 1) {
+            p->unique_symbols += histogram[i] > 0;
+        }
+    }
+    free(context);
+    return true;
+}
+
+// Decompresses an archive in src into dst. This does the work for
+// the library and the decode program. Returns false if the archive is
+// invalid or corrupted, or if dst is too small.
+//
+// src: archive
+// n: number of bytes in src
+// dst: decompressed data is written here
+// dst_len: capacity of dst, set to the size of the decompressed data
+// p: filled in with a profile of the run if not NULL
+// sink: told as the front of dst is finished, or NULL
+// shared: table the archive was coded with, or NULL
+bool huff_decode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t *dst_len, Profile *p,
+    HuffSink *sink, SharedTable *shared) {
+    return huff_decode_range(src, n, 0, UINT64_MAX, dst, dst_len, p, sink, shared);
+}
+
+// Decompresses only bytes from up to from + length of the original
+// data into dst. Archives created with FLAG_BLOCKS only decode the
+// blocks covering the range. dst_len holds the capacity of dst and is
+// set to the number of bytes decompressed, which is less than length
+// if the range runs past the end of the data. Returns false if src is
+// not a valid archive, a checksum does not match, or dst is too small.
+//
+// src: compressed data
+// n: number of bytes in src
+// from: offset of the first byte to decompress
+// length: number of bytes to decompress
+// dst: decompressed data is written here
+// dst_len: capacity of dst, set to the number of bytes decompressed
+bool huff_decompress_range(
+    const void *src, size_t n, uint64_t from, uint64_t length, void *dst, size_t *dst_len) {
+    uint64_t len = *dst_len;
+    bool ok = huff_decode_range(src, n, from, length, dst, &len, NULL, NULL, NULL);
+    *dst_len = len;
+    return ok;
+}
+
+// Decompresses src into dst. dst_len holds the capacity of dst and is
+// set to the size of the decompressed data. Returns false if src is
+// not a valid archive or dst is too small; huff_content_size() gives
+// the size that is needed.
+//
+// src: compressed data
+// n: number of bytes in src
+// dst: decompressed data is written here
+// dst_len: capacity of dst, set to the size of the decompressed data
+bool huff_decompress(const void *src, size_t n, void *dst, size_t *dst_len) {
+    uint64_t len = *dst_len;
+    bool ok = huff_decode(src, n, dst, &len, NULL, NULL, NULL);
+    *dst_len = len;
+    return ok;
+}
+
+// Creates a stream that collects input over any number of writes and
+// compresses it all at once in huff_stream_finish(). A stream can be
+// reused after it is finished, and keeps the codes of the built-in
+// text table around so that they are only built once.
+HuffStream *huff_stream_create(void) {
+    HuffStream *s = (HuffStream *) malloc(sizeof(HuffStream));
+    if (s) {
+        s->data = NULL;
+        s->size = 0;
+        s->capacity = 0;
+        Tree tree;
+        default_tree(&tree);
+        build_codes(&tree, s->static_codes);
+    }
+    return s;
+}
+
+// Frees the memory used by a stream and sets the pointer to NULL.
+//
+// s: stream to be deleted
+void huff_stream_delete(HuffStream **s) {
+    if (*s) {
+        free((*s)->data);
+        free(*s);
+        *s = NULL;
+    }
+}
+
+// Appends n bytes of src to the input of a stream. Returns false if
+// the stream could not grow its buffer.
+//
+// s: stream to write to
+// src: bytes to append
+// n: number of bytes in src
+bool huff_stream_write(HuffStream *s, const void *src, size_t n) {
+    if (s->size + n > s->capacity) {
+        uint64_t capacity = s->capacity ? s->capacity : BLOCK;
+        while (capacity < s->size + n) {
+            capacity *= 2;
+        }
+        uint8_t *data = (uint8_t *) realloc(s->data, capacity);
+        if (!data) {
+            return false;
+        }
+        s->data = data;
+        s->capacity = capacity;
+    }
+    memcpy(s->data + s->size, src, n);
+    s->size += n;
+    return true;
+}
+
+// Returns the largest size that finishing the stream can produce.
+//
+// s: stream to check
+size_t huff_stream_bound(HuffStream *s) {
+    return huff_compress_bound(s->size);
+}
+
+// Compresses all of the input written to a stream into dst and empties
+// the stream so that it can be used again. Returns false if dst is too
+// small, in which case the input is kept.
+//
+// s: stream to finish
+// dst: compressed data is written here
+// dst_len: capacity of dst, set to the size of the compressed data
+bool huff_stream_finish(HuffStream *s, void *dst, size_t *dst_len) {
+    uint64_t len = *dst_len;
+    if (!encode_with(
+            s->data, s->size, DEFAULT_PERMISSIONS, 0, dst, &len, NULL, NULL, NULL, s->static_codes)) {
+        return false;
+    }
+    *dst_len = len;
+    s->size = 0;
+    return true;
+}
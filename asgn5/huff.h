@@ -0,0 +1,50 @@
+#pragma once
+
+#include "header.h"
+#include "profile.h"
+#include "table.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct HuffStream HuffStream;
+
+// Told each time the first size bytes of the output are final, so that
+// they can be written out while the rest is still being coded.
+typedef struct {
+    void (*ready)(void *arg, uint64_t size);
+    void *arg;
+} HuffSink;
+
+size_t huff_compress_bound(size_t n);
+
+bool huff_compress(const void *src, size_t n, void *dst, size_t *dst_len);
+
+bool huff_content_size(const void *src, size_t n, uint64_t *size);
+
+bool huff_decompress(const void *src, size_t n, void *dst, size_t *dst_len);
+
+bool huff_decompress_range(
+    const void *src, size_t n, uint64_t from, uint64_t length, void *dst, size_t *dst_len);
+
+HuffStream *huff_stream_create(void);
+
+void huff_stream_delete(HuffStream **s);
+
+bool huff_stream_write(HuffStream *s, const void *src, size_t n);
+
+size_t huff_stream_bound(HuffStream *s);
+
+bool huff_stream_finish(HuffStream *s, void *dst, size_t *dst_len);
+
+bool huff_read_header(const uint8_t *src, uint64_t n, Header *h, HeaderExt *ext);
+
+bool huff_encode(const uint8_t *src, uint64_t n, uint16_t permissions, uint32_t options,
+    uint8_t *dst, uint64_t *dst_len, Profile *p, HuffSink *sink, SharedTable *shared);
+
+bool huff_decode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t *dst_len, Profile *p,
+    HuffSink *sink, SharedTable *shared);
+
+bool huff_decode_range(const uint8_t *src, uint64_t n, uint64_t from, uint64_t length,
+    uint8_t *dst, uint64_t *dst_len, Profile *p, HuffSink *sink, SharedTable *shared);
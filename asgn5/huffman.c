@@ -1,152 +1,279 @@
 #include "huffman.h"
 #include "defines.h"
 #include "pq.h"
-#include "io.h"
-#include "stack.h"
 
-#include <stdio.h>
-#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 
-static uint32_t symbols;
-// Credit to Prof. Long in the assignment 5 pdf
-// Uses a priority queue to store all the inputted symbols in nodes,
-// and then dequeues two nodes at a time, joins them, and does this
-// until there is only one node left, which is the returned root node.
+// Returns whether the node at index is a leaf.
+//
+// t: tree that holds the node
+// index: index of the node
+static inline bool is_leaf(Tree *t, uint16_t index) {
+    return t->nodes[index].left == NO_NODE;
+}
+
+// Builds the Huffman tree into the flat node array of t without any
+// allocations. The leaves are stored at the front of the array in
+// symbol order and interior nodes are appended after them. The two
+// least frequent nodes are taken from the index heap of pq.c and
+// joined until one node is left. The heap breaks ties on frequency by
+// index, so leaves go before interior nodes, leaves by symbol, and
+// interior nodes in the order they were made.
 //
+// t: tree that is built
 // hist[]: histogram with each symbols' frequency
-Node *build_tree(uint64_t hist[static ALPHABET]) {
-    PriorityQueue *tree = pq_create(ALPHABET);
-    // Enqueue every item in the histogram with a frequency > 0
+void build_tree(Tree *t, uint64_t hist[static ALPHABET]) {
+    PqEntry items[ALPHABET];
+    PriorityQueue q;
+    pq_init(&q, items, ALPHABET);
+    t->size = 0;
     for (uint32_t i = 0; i < ALPHABET; i += 1) {
         if (hist[i] > 0) {
-            Node *node = node_create(i, hist[i]);
-            enqueue(tree, node);
-            symbols += 1;
+            TreeNode leaf = { .frequency = hist[i], .left = NO_NODE, .right = NO_NODE, .symbol = i };
+            t->nodes[t->size] = leaf;
+            enqueue(&q, hist[i], t->size);
+            t->size += 1;
         }
     }
-    // Dequeue two nodes and join them into one
-    Node *left;
-    Node *right;
-    Node *root;
-    while (pq_size(tree) > 1) {
-        dequeue(tree, &left);
-        dequeue(tree, &right);
-        Node *parent = node_join(left, right);
-        enqueue(tree, parent);
+    t->root = t->size > 0 ? t->size - 1 : NO_NODE;
+
+    while (pq_size(&q) > 1) {
+        uint64_t left_key, right_key;
+        uint32_t left, right;
+        dequeue(&q, &left_key, &left);
+        dequeue(&q, &right_key, &right);
+        TreeNode parent = {
+            .frequency = left_key + right_key, .left = left, .right = right, .symbol = '$'
+        };
+        t->root = t->size;
+        t->nodes[t->size] = parent;
+        enqueue(&q, parent.frequency, t->size);
+        t->size += 1;
+    }
+}
+
+// English letters from most to least frequent, and how many times
+// each one appears in 10000 characters of lowercase English text.
+static const char letters[] = "etaoinshrdlcumwfgypbvkjxqz";
+static const uint64_t letter_freq[] = { 1016, 728, 656, 600, 560, 536, 504, 488, 480, 344, 320,
+    224, 224, 192, 192, 176, 160, 160, 152, 120, 80, 64, 16, 16, 8, 8 };
+
+// Fills hist with the built-in frequencies used for small text files.
+// Every symbol gets a frequency of at least 1 so that any input can
+// be encoded with it. Printable characters are weighted well above
+// the rest, and letters, spaces, and newlines highest of all.
+//
+// hist[]: histogram that is filled in
+void default_histogram(uint64_t hist[static ALPHABET]) {
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        hist[i] = 1;
+    }
+    // Printable ASCII characters
+    for (uint32_t i = ' '; i <= '~'; i += 1) {
+        hist[i] = 16;
+    }
+    for (uint32_t i = '0'; i <= '9'; i += 1) {
+        hist[i] = 48;
     }
-    dequeue(tree, &root);
-    pq_delete(&tree);
-    // Return root node
-    return root;
+    for (uint32_t i = 0; i < sizeof(letter_freq) / sizeof(letter_freq[0]); i += 1) {
+        hist[(uint8_t) letters[i]] = letter_freq[i];
+        // Uppercase letters are much rarer than lowercase ones
+        hist[(uint8_t) letters[i] - 'a' + 'A'] = letter_freq[i] / 16 + 8;
+    }
+    hist[' '] = 1700;
+    hist['\n'] = 200;
+    hist['\t'] = 32;
+    hist['.'] = 96;
+    hist[','] = 96;
+}
+
+// Builds the Huffman tree for the built-in text frequencies. The
+// encoder and decoder both call this, so the tree never has to be
+// dumped into the compressed file.
+//
+// t: tree that is built
+void default_tree(Tree *t) {
+    uint64_t hist[ALPHABET];
+    default_histogram(hist);
+    build_tree(t, hist);
 }
 
-static Code c;
-static bool init = true;
 // Credit to Prof. Long in the assignment 5 pdf
-// Creates a code for each symbol using a post-order traversal
-// and stores the respective codes in the table array.
+// Walks the subtree under index, pushing a 0 for every left turn and
+// a 1 for every right turn, and stores the path to each leaf as the
+// code of its symbol.
 //
-// root: start at the root of the tree
+// t: tree that is walked
+// index: index of the current node
+// c: path from the root to the current node
 // table: array that will store each symbols' code
-void build_codes(Node *root, Code table[static ALPHABET]) {
-    if (init) {
-        c = code_init();
-        init = false;
-    }
+static void codes_from(Tree *t, uint16_t index, Code *c, Code table[static ALPHABET]) {
     uint8_t temp;
-    // Post order traversal starting from root of the tree
-    if (root != NULL) {
-        if (root->left == NULL && root->right == NULL) {
-            // Once a leaf is reached, store the code in the table
-            table[root->symbol] = c;
-        } else {
-            // Go down the left side of the tree by pushing a 0
-            code_push_bit(&c, 0);
-            build_codes(root->left, table);
-            code_pop_bit(&c, &temp);
-
-            // Go down the right side of the tree by pushing a 1
-            code_push_bit(&c, 1);
-            build_codes(root->right, table);
-            code_pop_bit(&c, &temp);
+    if (is_leaf(t, index)) {
+        // Once a leaf is reached, store the code in the table
+        table[t->nodes[index].symbol] = *c;
+        return;
+    }
+    // Go down the left side of the tree by pushing a 0
+    code_push_bit(c, 0);
+    codes_from(t, t->nodes[index].left, c, table);
+    code_pop_bit(c, &temp);
+
+    // Go down the right side of the tree by pushing a 1
+    code_push_bit(c, 1);
+    codes_from(t, t->nodes[index].right, c, table);
+    code_pop_bit(c, &temp);
+}
+
+// Creates a code for each symbol in the tree and stores the
+// respective codes in the table array.
+//
+// t: tree to create codes from
+// table: array that will store each symbols' code
+void build_codes(Tree *t, Code table[static ALPHABET]) {
+    Code c = code_init();
+    if (t->root != NO_NODE) {
+        codes_from(t, t->root, &c, table);
+    }
+}
+
+// Returns the depth of the subtree under index.
+//
+// t: tree that is walked
+// index: index of the current node
+static uint32_t depth_from(Tree *t, uint16_t index) {
+    if (is_leaf(t, index)) {
+        return 0;
+    }
+    uint32_t left = depth_from(t, t->nodes[index].left);
+    uint32_t right = depth_from(t, t->nodes[index].right);
+    return 1 + (left > right ? left : right);
+}
+
+// Returns the depth of the tree, which is the length of its
+// longest code.
+//
+// t: tree that is measured
+uint32_t tree_depth(Tree *t) {
+    return t->root != NO_NODE ? depth_from(t, t->root) : 0;
+}
+
+// Walks the subtree under index down to TABLE_BITS levels and fills
+// in the table entries of every leaf it reaches. A code of length len
+// owns every entry whose low len bits match it, since the bits after
+// the code belong to the codes that follow.
+//
+// t: tree that is walked
+// index: index of the current node
+// code: bits of the path from the root, the first bit lowest
+// len: length of the path
+// d: table that is filled in
+static void table_from(Tree *t, uint16_t index, uint32_t code, uint32_t len, DecodeTable *d) {
+    if (is_leaf(t, index)) {
+        if (len > 0) {
+            for (uint32_t rest = 0; rest < (1u << (TABLE_BITS - len)); rest += 1) {
+                d->entries[code | rest << len] = len << 8 | t->nodes[index].symbol;
+            }
         }
+        return;
+    }
+    if (len < TABLE_BITS) {
+        table_from(t, t->nodes[index].left, code, len + 1, d);
+        table_from(t, t->nodes[index].right, code | 1u << len, len + 1, d);
+    }
+}
+
+// Builds the decoding table of a tree. Entries for codes longer than
+// TABLE_BITS, and every entry of a tree whose root is a leaf, keep a
+// length of 0 so that the decoder walks the tree for them instead.
+//
+// t: tree to build the table from
+// d: table that is built
+void build_table(Tree *t, DecodeTable *d) {
+    memset(d->entries, 0, sizeof(d->entries));
+    if (t->root != NO_NODE) {
+        table_from(t, t->root, 0, 0, d);
     }
 }
 
-static uint8_t buf[BLOCK] = { 0 };
-static uint32_t counter = 0;
 // Credit to Prof. Long in the assignment 5 pdf
 // Uses post-order traversal to buffer an 'L' and a node's symbol
 // if a leaf node is reached, or an 'I' if an interior node is
-// reached. Once the amount of symbols buffer equals the tree
-// size, write out the buffer to outfile.
+// reached. Returns the number of bytes in the buffer afterwards.
 //
-// outfile: print to this output file
-// root: start at the root of the tree
-void dump_tree(int outfile, Node *root) {
-    if (root) {
-        // Post order traversal
-        dump_tree(outfile, root->left);
-        dump_tree(outfile, root->right);
-
-        if (root->left == NULL && root->right == NULL) {
-            // If a leaf node is reached, buffer L and the symbol
-            buf[counter] = 76;
-            counter += 1;
-            buf[counter] = root->symbol;
-            counter += 1;
-        } else {
-            // Interior node is buffered
-            buf[counter] = 73;
-            counter += 1;
-        }
-    }
-    // If counter equals tree size, write the buffer and set counter to 0
-    if (counter == 3 * symbols - 1) {
-        write_bytes(outfile, buf, counter);
-        counter = 0;
+// t: tree that is dumped
+// index: index of the current node
+// buf: buffer the dump is written into
+// n: number of bytes already in buf
+static uint32_t dump_from(Tree *t, uint16_t index, uint8_t *buf, uint32_t n) {
+    if (is_leaf(t, index)) {
+        buf[n++] = 'L';
+        buf[n++] = t->nodes[index].symbol;
+        return n;
     }
+    n = dump_from(t, t->nodes[index].left, buf, n);
+    n = dump_from(t, t->nodes[index].right, buf, n);
+    buf[n++] = 'I';
+    return n;
+}
+
+// Dumps the tree into buf in post-order. Returns the number of bytes
+// in the dump, which is 3 * leaves - 1.
+//
+// t: tree that is dumped
+// buf: buffer the dump is written into
+uint32_t dump_tree(Tree *t, uint8_t buf[static MAX_TREE_SIZE]) {
+    return t->root != NO_NODE ? dump_from(t, t->root, buf, 0) : 0;
 }
 
-// Iterates through the dumped tree and creates nodes for
-// each leaf. Uses a stack to store each node. Returns
-// the root of the tree.
+// Iterates through the dumped tree and rebuilds it in the flat node
+// array of t, using a stack of node indices. Returns false if the
+// dump does not describe a single valid tree. The encoder always dumps
+// at least two leaves, so a lone leaf is rejected as well, which keeps
+// every code at least one bit long.
 //
+// t: tree that is rebuilt
 // nbytes: length of the array tree_dump
 // tree_dump: array with the entire tree dump
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree_dump[static nbytes]) {
-    Stack *node_stack = stack_create(nbytes);
-    for (uint16_t i = 0; i < nbytes; i += 1) {
-        // If the symbol is L, create a node for the leaf and push to stack
+bool rebuild_tree(Tree *t, uint16_t nbytes, const uint8_t tree_dump[static nbytes]) {
+    uint16_t stack[ALPHABET];
+    uint32_t top = 0;
+    t->size = 0;
+    t->root = NO_NODE;
+    for (uint32_t i = 0; i < nbytes; i += 1) {
+        if (t->size == MAX_NODES) {
+            return false;
+        }
+        TreeNode *n = &t->nodes[t->size];
+        // If the symbol is L, create a leaf and push it to the stack
         if (tree_dump[i] == 'L') {
+            if (i + 1 == nbytes || top == ALPHABET) {
+                return false;
+            }
             // Jump to the leaf node
             i += 1;
-            Node *leaf = node_create(tree_dump[i], 0);
-            stack_push(node_stack, leaf);
+            n->frequency = 0;
+            n->left = NO_NODE;
+            n->right = NO_NODE;
+            n->symbol = tree_dump[i];
             // If the symbol is I, pop left and right nodes and create a parent
         } else {
-            Node *right;
-            Node *left;
-            stack_pop(node_stack, &right);
-            stack_pop(node_stack, &left);
-            Node *parent = node_join(left, right);
-            stack_push(node_stack, parent);
+            if (top < 2) {
+                return false;
+            }
+            n->frequency = 0;
+            n->right = stack[--top];
+            n->left = stack[--top];
+            n->symbol = '$';
         }
+        stack[top++] = t->size;
+        t->size += 1;
     }
-    // Pop the root node and return it
-    Node *root;
-    stack_pop(node_stack, &root);
-    stack_delete(&node_stack);
-    return root;
-}
-
-// Delete each node in the tree by freeing them from memory
-//
-// root: start from the root node
-void delete_tree(Node **root) {
-    if (*root) {
-        delete_tree(&(*root)->left);
-        delete_tree(&(*root)->right);
-        node_delete(root);
+    // The root is the only node left on the stack
+    if (top != 1 || t->nodes[stack[0]].left == NO_NODE) {
+        return false;
     }
+    t->root = stack[0];
+    return true;
 }
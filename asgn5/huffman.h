@@ -2,16 +2,42 @@
 
 #include "code.h"
 #include "defines.h"
-#include "node.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
-Node *build_tree(uint64_t hist[static ALPHABET]);
+#define NO_NODE UINT16_MAX // Child index of a leaf.
 
-void build_codes(Node *root, Code table[static ALPHABET]);
+typedef struct {
+    uint64_t frequency;
+    uint16_t left; // Index of the left child, NO_NODE for a leaf.
+    uint16_t right; // Index of the right child, NO_NODE for a leaf.
+    uint8_t symbol;
+} TreeNode;
 
-void dump_tree(int outfile, Node *root);
+typedef struct {
+    TreeNode nodes[MAX_NODES]; // Leaves first, then interior nodes.
+    uint16_t size; // Number of nodes in use.
+    uint16_t root; // Index of the root, NO_NODE for an empty tree.
+} Tree;
 
-Node *rebuild_tree(uint16_t nbytes, uint8_t tree[static nbytes]);
+// Decodes a whole code at once from the next TABLE_BITS bits of input.
+typedef struct {
+    uint16_t entries[1 << TABLE_BITS]; // Symbol in the low byte, code length in the high byte.
+} DecodeTable;
 
-void delete_tree(Node **root);
+void build_tree(Tree *t, uint64_t hist[static ALPHABET]);
+
+void default_histogram(uint64_t hist[static ALPHABET]);
+
+void default_tree(Tree *t);
+
+void build_codes(Tree *t, Code table[static ALPHABET]);
+
+uint32_t tree_depth(Tree *t);
+
+void build_table(Tree *t, DecodeTable *d);
+
+uint32_t dump_tree(Tree *t, uint8_t buf[static MAX_TREE_SIZE]);
+
+bool rebuild_tree(Tree *t, uint16_t nbytes, const uint8_t tree[static nbytes]);
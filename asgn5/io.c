@@ -2,22 +2,21 @@
 #include "code.h"
 #include "defines.h"
 
-#include <unistd.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static int count = 0;
 // Keeps track of total bytes read and written
 uint64_t bytes_read = 0;
 uint64_t bytes_written = 0;
-
-// Used in write_bytes, write_code, and flush_codes
-static uint8_t write_buf[BLOCK] = { 0 };
-static uint32_t write_index = 0;
-
-// Used in read_bytes and read_bit
-static uint8_t read_buf[BLOCK] = { 0 };
-static uint32_t read_index = 0;
-static uint32_t read_end = -1;
+// Keeps track of the system calls made for the -v statistics
+uint64_t read_calls = 0;
+uint64_t write_calls = 0;
+uint64_t map_calls = 0;
 
 // Credit to Eugene
 // Reads a specified number of bytes from infile and
@@ -38,8 +37,11 @@ int read_bytes(int infile, uint8_t *buf, int nbytes) {
     // Loops calls to read() until all bytes are read
     do {
         count = read(infile, buf + bytes, nbytes - bytes);
-        bytes += count;
-        bytes_read += count;
+        read_calls += 1;
+        if (count > 0) {
+            bytes += count;
+            bytes_read += count;
+        }
     } while (count > 0);
     return bytes;
 }
@@ -63,89 +65,192 @@ int write_bytes(int outfile, uint8_t *buf, int nbytes) {
     // Loop calls to write() until all bytes are written
     do {
         count = write(outfile, buf + bytes, nbytes - bytes);
-        bytes += count;
-        bytes_written += count;
+        write_calls += 1;
+        if (count > 0) {
+            bytes += count;
+            bytes_written += count;
+        }
     } while (count > 0);
     return bytes;
 }
 
-// Credit to Eugene
-// Read bits one at a time from a full buffer. Only provide
-// the value of one bit each time this function is called.
-// Return true if there are still bits to read.
+// Reads the next bit from a buffer of codes. Returns false once
+// every bit in the buffer has been read.
 //
-// infile: read from this input file
+// r: read from this buffer
 // bit: store the value of the read bit here
-bool read_bit(int infile, uint8_t *bit) {
-    int bytes = 0;
-    if (read_index == 0) {
-        bytes = read_bytes(infile, read_buf, BLOCK);
-        // Set end to be last valid bit
-        if (bytes < BLOCK) {
-            read_end = bytes * 8 + 1;
-        }
+bool read_bit(BitReader *r, uint8_t *bit) {
+    if (r->index >= 8 * r->size) {
+        return false;
     }
-
-    if ((read_buf[read_index / 8] >> read_index % 8) & 0x1) {
-        *bit = 1;
-    } else {
-        *bit = 0;
-    }
-    read_index++;
-
-    // Reset read_bit_top if you are done reading
-    if (read_index == BLOCK * 8) {
-        read_index = 0;
-    }
-    return read_index != read_end;
+    *bit = (r->data[r->index / 8] >> r->index % 8) & 0x1;
+    r->index++;
+    return true;
 }
 
 // Credit to Prof. Long from Code Comments Repo
-// Iterate through the entire given code and buffer each
-// bit into a buffer. Write out the buffer once it is
-// full.
+// Appends the bits of a code to a buffer. The code is copied a byte
+// at a time and shifted into place, rather than one bit at a time.
+// Bits past the end of what has been written are always kept
+// cleared, so a byte that is only partly filled can be or'ed into.
+// Returns false if the buffer does not have room for the code.
 //
-// outfile: write to this output file
+// w: write to this buffer
 // c: get the bits from this code
-void write_code(int outfile, Code *c) {
-    for (uint32_t i = 0; i < code_size(c); i += 1) {
-        // Get the bit from the code
-        bool bit = code_get_bit(c, i);
-        if (bit) {
-            // Set the bit at this index
-            write_buf[write_index / 8] |= (0x1 << (write_index % 8));
+bool write_code(BitWriter *w, Code *c) {
+    uint32_t n = code_size(c);
+    if (w->index + n > 8 * w->size) {
+        return false;
+    }
+    uint64_t byte = w->index / 8;
+    uint32_t shift = w->index % 8;
+    for (uint32_t i = 0; i < n; i += 8) {
+        // Only keep the bits that belong to the code
+        uint8_t bits = c->bits[i / 8];
+        uint32_t len = n - i < 8 ? n - i : 8;
+        if (len < 8) {
+            bits &= (0x1 << len) - 1;
+        }
+        if (shift == 0) {
+            w->data[byte] = bits;
         } else {
-            // Clear the bit at this index
-            write_buf[write_index / 8] &= ~(0x1 << (write_index % 8));
+            // Fill the top of this byte and spill into the next one
+            w->data[byte] |= bits << shift;
+            if (shift + len > 8) {
+                w->data[byte + 1] = bits >> (8 - shift);
+            }
         }
-        write_index++;
-        // Write the buffer once it is full
-        if (write_index / 8 == BLOCK) {
-            write_bytes(outfile, write_buf, BLOCK);
-            write_index = 0;
+        byte += 1;
+    }
+    w->index += n;
+    return true;
+}
+
+// Returns the number of bytes holding the codes written so far. The
+// unused bits of the last byte are already cleared.
+//
+// w: buffer that was written to
+uint64_t flush_codes(BitWriter *w) {
+    return (w->index + 7) / 8;
+}
+
+// Makes the entire contents of infile available in memory. Regular
+// files are memory-mapped so they can be read any number of times
+// without copying. Anything that cannot be mapped, such as a pipe,
+// is read into a growing heap buffer in IO_BLOCK sized reads.
+// Returns false if the fallback buffer could not be allocated.
+//
+// infile: file to map
+// m: set to the mapped data, its size, and how it was obtained
+bool io_map(int infile, Mapping *m) {
+    struct stat st;
+    m->data = NULL;
+    m->size = 0;
+    m->mapped = false;
+
+    if (fstat(infile, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, infile, 0);
+        map_calls += 1;
+        if (data != MAP_FAILED) {
+            // Both passes of the encoder walk the file front to back
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            m->data = (uint8_t *) data;
+            m->size = st.st_size;
+            m->mapped = true;
+            return true;
+        }
+    }
+
+    // Not seekable or not mappable, so buffer the whole input
+    uint64_t capacity = 0;
+    int bytes = 0;
+    do {
+        if (m->size + IO_BLOCK > capacity) {
+            capacity = capacity ? 2 * capacity : IO_BLOCK;
+            uint8_t *data = (uint8_t *) realloc(m->data, capacity);
+            if (!data) {
+                io_unmap(m);
+                return false;
+            }
+            m->data = data;
         }
+        bytes = read_bytes(infile, m->data + m->size, IO_BLOCK);
+        m->size += bytes;
+    } while (bytes > 0);
+    return true;
+}
+
+// Releases the memory behind a Mapping created by io_map().
+//
+// m: mapping to release
+void io_unmap(Mapping *m) {
+    if (m->mapped) {
+        munmap(m->data, m->size);
+        map_calls += 1;
+    } else {
+        free(m->data);
+    }
+    m->data = NULL;
+    m->size = 0;
+    m->mapped = false;
+}
+
+// Sizes outfile to size bytes and maps it, so that output can be coded
+// straight into the file instead of into a buffer of its own. Returns
+// false, leaving the file alone, if outfile is not a regular file that
+// is open for reading and writing at offset 0.
+//
+// outfile: file to map
+// size: largest number of bytes that will be written
+// m: the mapping is stored here
+bool io_map_output(int outfile, uint64_t size, Mapping *m) {
+    struct stat st;
+    m->data = NULL;
+    m->size = 0;
+    m->mapped = false;
+    if (size == 0 || fstat(outfile, &st) != 0 || !S_ISREG(st.st_mode)
+        || lseek(outfile, 0, SEEK_CUR) != 0 || ftruncate(outfile, size) != 0) {
+        return false;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, outfile, 0);
+    map_calls += 1;
+    if (data == MAP_FAILED) {
+        ftruncate(outfile, 0);
+        return false;
     }
+    m->data = (uint8_t *) data;
+    m->size = size;
+    m->mapped = true;
+    return true;
+}
+
+// Unmaps a mapping created by io_map_output() and cuts the file down
+// to the size bytes that were written into it.
+//
+// outfile: file that was mapped
+// m: mapping to release
+// size: number of bytes written into the mapping
+void io_unmap_output(int outfile, Mapping *m, uint64_t size) {
+    io_unmap(m);
+    ftruncate(outfile, size);
+    lseek(outfile, size, SEEK_SET);
+    bytes_written += size;
 }
 
-// In the case that write_code() does not fill the buffer
-// and thus, does not write out the buffer, this function
-// will flush out the remaining codes in the buffer.
+// Preallocates size bytes of disk space past the current offset of
+// outfile so that the file does not have to grow on every write.
+// Does nothing if outfile is not a regular file. size must be the
+// exact number of bytes that will be written, since the file length
+// is extended to cover the reserved space.
 //
-// outfile: write to this output file
-void flush_codes(int outfile) {
-    // If there are any bits remaining in the buffer
-    if (write_index > 0) {
-        // Keep track of the bytes needed for remaining bits
-        int bytes_needed = write_index / 8;
-        if (write_index % 8 != 0) {
-            do {
-                // Clear out the extra bits in a byte if necessary
-                write_buf[write_index / 8] &= ~(0x1 << (write_index % 8));
-                write_index += 1;
-            } while (write_index % 8 != 0);
-            bytes_needed += 1;
+// outfile: file to preallocate
+// size: number of bytes that will be written
+void io_reserve(int outfile, uint64_t size) {
+    struct stat st;
+    if (size > 0 && fstat(outfile, &st) == 0 && S_ISREG(st.st_mode)) {
+        off_t offset = lseek(outfile, 0, SEEK_CUR);
+        if (offset >= 0) {
+            posix_fallocate(outfile, offset, size);
         }
-        // Write out only the amount of bytes necessary
-        write_bytes(outfile, write_buf, bytes_needed);
     }
 }
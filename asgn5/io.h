@@ -5,15 +5,46 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+typedef struct {
+    uint8_t *data;
+    uint64_t size;
+    bool mapped;
+} Mapping;
+
+typedef struct {
+    uint8_t *data;
+    uint64_t size; // Capacity in bytes.
+    uint64_t index; // Number of bits written.
+} BitWriter;
+
+typedef struct {
+    const uint8_t *data;
+    uint64_t size; // Length in bytes.
+    uint64_t index; // Number of bits read.
+} BitReader;
+
 extern uint64_t bytes_read;
 extern uint64_t bytes_written;
+extern uint64_t read_calls;
+extern uint64_t write_calls;
+extern uint64_t map_calls;
 
 int read_bytes(int infile, uint8_t *buf, int nbytes);
 
 int write_bytes(int outfile, uint8_t *buf, int nbytes);
 
-bool read_bit(int infile, uint8_t *bit);
+bool read_bit(BitReader *r, uint8_t *bit);
+
+bool write_code(BitWriter *w, Code *c);
+
+uint64_t flush_codes(BitWriter *w);
+
+bool io_map(int infile, Mapping *m);
+
+void io_unmap(Mapping *m);
+
+bool io_map_output(int outfile, uint64_t size, Mapping *m);
 
-void write_code(int outfile, Code *c);
+void io_unmap_output(int outfile, Mapping *m, uint64_t size);
 
-void flush_codes(int outfile);
+void io_reserve(int outfile, uint64_t size);
@@ -0,0 +1,117 @@
+#include "pipeline.h"
+#include "io.h"
+
+#include <sched.h>
+#include <time.h>
+
+// Waits a little before a thread checks the ring again. The first
+// waits only yield the CPU, later ones sleep so that a thread that is
+// waiting on a slow coder does not keep a core busy.
+//
+// waits: number of times the thread has already waited
+static void backoff(uint32_t *waits) {
+    if (*waits < 64) {
+        sched_yield();
+    } else {
+        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50000 };
+        nanosleep(&ts, NULL);
+    }
+    *waits += 1;
+}
+
+// Empties a ring.
+//
+// r: ring to initialize
+void ring_init(Ring *r) {
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+}
+
+// Adds a chunk to the back of the ring, waiting while it is full. The
+// release store publishes the chunk, and everything written to its
+// data before the push, to the consumer.
+//
+// r: ring to push to
+// c: chunk to push
+void ring_push(Ring *r, Chunk c) {
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t waits = 0;
+    while (tail - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SLOTS) {
+        backoff(&waits);
+    }
+    r->slots[tail % RING_SLOTS] = c;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+// Removes and returns the chunk at the front of the ring, waiting
+// while it is empty.
+//
+// r: ring to pop from
+Chunk ring_pop(Ring *r) {
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t waits = 0;
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) == head) {
+        backoff(&waits);
+    }
+    Chunk c = r->slots[head % RING_SLOTS];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return c;
+}
+
+// Body of the writer thread: writes every chunk that comes out of the
+// ring until the end of the output is reached.
+//
+// arg: the pipeline
+static void *writer(void *arg) {
+    Pipeline *p = (Pipeline *) arg;
+    for (Chunk c = ring_pop(&p->ring); c.data; c = ring_pop(&p->ring)) {
+        for (uint64_t i = 0; i < c.size; i += IO_BLOCK) {
+            write_bytes(p->outfile, (uint8_t *) c.data + i,
+                c.size - i < IO_BLOCK ? c.size - i : IO_BLOCK);
+        }
+    }
+    return NULL;
+}
+
+// Starts a writer thread for output that is coded into data. Returns
+// false if the thread could not be created.
+//
+// p: pipeline to start
+// outfile: file descriptor the output is written to
+// data: buffer the output is coded into
+bool pipeline_start(Pipeline *p, int outfile, const uint8_t *data) {
+    ring_init(&p->ring);
+    p->outfile = outfile;
+    p->data = data;
+    p->queued = 0;
+    return pthread_create(&p->writer, NULL, writer, p) == 0;
+}
+
+// Tells the pipeline that the first size bytes of the output are
+// final. They are handed to the writer once at least IO_BLOCK bytes
+// are waiting, so that writes stay large. Matches the callback of a
+// HuffSink.
+//
+// arg: the pipeline
+// size: bytes at the front of the output that are final
+void pipeline_ready(void *arg, uint64_t size) {
+    Pipeline *p = (Pipeline *) arg;
+    if (size >= p->queued + IO_BLOCK) {
+        ring_push(&p->ring, (Chunk) { .data = p->data + p->queued, .size = size - p->queued });
+        p->queued = size;
+    }
+}
+
+// Hands the rest of the output to the writer and waits until all of
+// it has been written.
+//
+// p: pipeline to finish
+// size: total bytes of output
+void pipeline_finish(Pipeline *p, uint64_t size) {
+    if (size > p->queued) {
+        ring_push(&p->ring, (Chunk) { .data = p->data + p->queued, .size = size - p->queued });
+        p->queued = size;
+    }
+    ring_push(&p->ring, (Chunk) { .data = NULL, .size = 0 });
+    pthread_join(p->writer, NULL);
+}
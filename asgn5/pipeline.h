@@ -0,0 +1,42 @@
+#pragma once
+
+#include "defines.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    const uint8_t *data; // NULL marks the end of the output.
+    uint64_t size;
+} Chunk;
+
+// Lock-free queue with exactly one thread pushing and one popping.
+typedef struct {
+    Chunk slots[RING_SLOTS];
+    _Atomic uint64_t head; // Chunks popped so far, only advanced by the consumer.
+    _Atomic uint64_t tail; // Chunks pushed so far, only advanced by the producer.
+} Ring;
+
+// Writes the finished front of an output buffer on a thread of its
+// own while the rest of the buffer is still being coded.
+typedef struct {
+    Ring ring;
+    pthread_t writer;
+    int outfile;
+    const uint8_t *data; // Output buffer.
+    uint64_t queued; // Bytes of data handed to the writer so far.
+} Pipeline;
+
+void ring_init(Ring *r);
+
+void ring_push(Ring *r, Chunk c);
+
+Chunk ring_pop(Ring *r);
+
+bool pipeline_start(Pipeline *p, int outfile, const uint8_t *data);
+
+void pipeline_ready(void *arg, uint64_t size);
+
+void pipeline_finish(Pipeline *p, uint64_t size);
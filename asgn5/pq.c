@@ -1,100 +1,37 @@
 #include "pq.h"
 
-#include "node.h"
-
-#include <math.h>
 #include <stdio.h> // only used for debugging
 #include <stdlib.h>
 
-// Credit to Prof. Long from assignment 3
-// Returns 1 if x is more frequent than y,
-// -1 if not, and 0 otherwise.
-//
-// x: first node to be compared
-// y: second node to be compared
-int cmp(Node x, Node y) {
-    if (y.frequency < x.frequency) {
-        return 1;
-    } else if (y.frequency < x.frequency) {
-        return -1;
-    } else {
-        return 0;
-    }
-}
-
-// Credit to Prof. Long from assignment 3
-// Swaps the pointers of the nodes.
+// Returns true if x comes out of the queue before y. Ties on the key
+// are broken by index so the order never depends on the heap layout.
 //
-// x: first node to be swapped
-// y: second node to be swapped
-void swap(Node *x, Node *y) {
-    Node temp = *x;
-    *x = *y;
-    *y = temp;
+// x: first entry to be compared
+// y: second entry to be compared
+static inline bool before(PqEntry x, PqEntry y) {
+    return x.key < y.key || (x.key == y.key && x.index < y.index);
 }
 
-// Finds the node with the lowest frequency and returns it.
+// Sets up an empty PriorityQueue that keeps its entries in items, so
+// that it can live on the stack without any allocations.
 //
-// items: array of nodes
-// first: parent node
-// last: last valid index in the nodes array
-uint32_t min_child(Node **items, uint32_t first, uint32_t last) {
-    uint32_t left = 2 * first;
-    uint32_t right = left + 1;
-    if ((right <= last) && (cmp(*items[left - 1], *items[right - 1]) == 1)) {
-        return right; // right is the smallest child
-    }
-    return left; // left is the smallest child
-}
-
-// Fixes a min heap by swapping a parent and child node if
-// the child node is smaller than the parent.
-//
-// items: array of nodes
-// first: parent node
-// last: last valid index in the nodes array
-void fix_heap(Node **items, uint32_t first, uint32_t last) {
-    bool found = false;
-    uint32_t mother = first;
-    uint32_t small = min_child(items, mother, last);
-
-    while ((mother <= floor(last / 2.0)) && !(found)) {
-        if (cmp(*items[mother - 1], *items[small - 1]) == 1) { // smallest child < mother
-            swap(items[mother - 1], items[small - 1]); // swap them
-            mother = small;
-            small = min_child(items, mother, last); // check the next children
-        } else {
-            found = true;
-        }
-    }
-    return;
-}
-
-void build_heap(Node **items, uint32_t first, uint32_t last) {
-    for (uint32_t father = floor(last / 2.0); father > first - 1; father -= 1) {
-        fix_heap(items, father, last);
-    }
-    return;
+// q: PriorityQueue that is set up
+// items: storage for capacity entries
+// capacity: maximum capacity for the PriorityQueue
+void pq_init(PriorityQueue *q, PqEntry *items, uint32_t capacity) {
+    q->top = 0;
+    q->capacity = capacity;
+    q->items = items;
 }
 
-// Declaration for PriorityQueue struct
-struct PriorityQueue {
-    uint32_t top;
-    uint32_t capacity;
-    Node **items;
-};
-
-// Creates and returns a PriorityQueue with a specified capacity,
-// the top set to 0, and dynamically allocates memory for the
-// PriorityQueue and array of nodes.
+// Creates and returns a PriorityQueue with a specified capacity and
+// the top set to 0, or NULL if the memory could not be allocated.
 //
 // capacity: maximum capacity for the PriorityQueue
 PriorityQueue *pq_create(uint32_t capacity) {
     PriorityQueue *pq = (PriorityQueue *) malloc(sizeof(PriorityQueue));
     if (pq) {
-        pq->top = 0;
-        pq->capacity = capacity;
-        pq->items = (Node **) calloc(capacity, sizeof(Node *));
+        pq_init(pq, (PqEntry *) malloc(capacity * sizeof(PqEntry)), capacity);
         if (!pq->items) {
             free(pq);
             pq = NULL;
@@ -103,31 +40,30 @@ PriorityQueue *pq_create(uint32_t capacity) {
     return pq;
 }
 
-// Frees memory used by the PriorityQueue and nodes array
+// Frees memory used by the PriorityQueue and entries array
 // and dereferences the pointer to NULL before returning.
 //
 // q: PriorityQueue that is to be deleted
 void pq_delete(PriorityQueue **q) {
-    if (*q && (*q)->items) {
+    if (*q) {
         free((*q)->items);
         free(*q);
         *q = NULL;
     }
-    return;
 }
 
 // Returns true if the PriorityQueue is empty, false otherwise.
 //
 // q: PriorityQueue that is checked
 bool pq_empty(PriorityQueue *q) {
-    return (q->top == 0);
+    return q->top == 0;
 }
 
 // Returns true if the PriorityQueue is full, false otherwise.
 //
 // q: PriorityQueue that is checked
 bool pq_full(PriorityQueue *q) {
-    return (q->top == q->capacity);
+    return q->top == q->capacity;
 }
 
 // Returns the number of items in the PriorityQueue
@@ -137,43 +73,66 @@ uint32_t pq_size(PriorityQueue *q) {
     return q->top;
 }
 
-// Enqueues an node into the PriorityQueue if it is not full.
-// Rebuilds the min heap once the node is added.
+// Enqueues a node index with its key if the PriorityQueue is not
+// full. The new entry moves up from the bottom of the binary heap
+// until its parent comes before it, which takes O(log n) steps.
 // Returns false if full and true otherwise.
 //
 // q: enqueue into this PriorityQueue
-// n: node that is enqueued
-bool enqueue(PriorityQueue *q, Node *n) {
+// key: frequency the entry is ordered by
+// index: index of the node in the caller's array
+bool enqueue(PriorityQueue *q, uint64_t key, uint32_t index) {
     if (pq_full(q)) {
         return false;
     }
-    q->items[q->top] = n;
-    q->top++;
-    build_heap(q->items, 1, pq_size(q));
+    PqEntry e = { .key = key, .index = index };
+    uint32_t hole = q->top;
+    q->top += 1;
+    // Shift parents down into the hole instead of swapping
+    while (hole > 0 && before(e, q->items[(hole - 1) / 2])) {
+        q->items[hole] = q->items[(hole - 1) / 2];
+        hole = (hole - 1) / 2;
+    }
+    q->items[hole] = e;
     return true;
 }
 
-// Dequeues an node from the PriorityQueue if it is not empty.
-// Rebuilds the min heap once the node is dequeued.
+// Dequeues the entry with the smallest key if the PriorityQueue is
+// not empty. The last entry is sifted down from the root into the
+// place left by the smallest one, in O(log n) steps.
 // Returns false if empty and true otherwise.
 //
 // q: dequeue from this PriorityQueue
-// n: node that is dequeued
-bool dequeue(PriorityQueue *q, Node **n) {
+// key: the key of the dequeued entry is passed back with this
+// index: the node index of the dequeued entry is passed back with this
+bool dequeue(PriorityQueue *q, uint64_t *key, uint32_t *index) {
     if (pq_empty(q)) {
         return false;
     }
-    swap(q->items[0], q->items[pq_size(q) - 1]);
-    *n = q->items[pq_size(q) - 1];
-    q->top--;
-    build_heap(q->items, 1, pq_size(q));
+    *key = q->items[0].key;
+    *index = q->items[0].index;
+    q->top -= 1;
+    PqEntry last = q->items[q->top];
+    uint32_t hole = 0;
+    for (uint32_t child = 1; child < q->top; child = 2 * hole + 1) {
+        // Pick the smaller child
+        if (child + 1 < q->top && before(q->items[child + 1], q->items[child])) {
+            child += 1;
+        }
+        if (!before(q->items[child], last)) {
+            break;
+        }
+        q->items[hole] = q->items[child];
+        hole = child;
+    }
+    q->items[hole] = last;
     return true;
 }
 
 // Debug function for pq
 void pq_print(PriorityQueue *q) {
     for (uint32_t i = 0; i < q->top; i++) {
-        printf("Item %d: %lu ", i, (q->items[i])->frequency);
+        printf("Item %u: %lu (node %u) ", i, q->items[i].key, q->items[i].index);
     }
     printf("\n");
 }
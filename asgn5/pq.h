@@ -1,11 +1,22 @@
 #pragma once
 
-#include "node.h"
-
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef struct PriorityQueue PriorityQueue;
+// An item in the heap: the index of a node in the caller's node array
+// and its frequency, cached so comparisons never touch the nodes.
+typedef struct {
+    uint64_t key;
+    uint32_t index;
+} PqEntry;
+
+typedef struct {
+    uint32_t top;
+    uint32_t capacity;
+    PqEntry *items;
+} PriorityQueue;
+
+void pq_init(PriorityQueue *q, PqEntry *items, uint32_t capacity);
 
 PriorityQueue *pq_create(uint32_t capacity);
 
@@ -17,8 +28,8 @@ bool pq_full(PriorityQueue *q);
 
 uint32_t pq_size(PriorityQueue *q);
 
-bool enqueue(PriorityQueue *q, Node *n);
+bool enqueue(PriorityQueue *q, uint64_t key, uint32_t index);
 
-bool dequeue(PriorityQueue *q, Node **n);
+bool dequeue(PriorityQueue *q, uint64_t *key, uint32_t *index);
 
 void pq_print(PriorityQueue *q);
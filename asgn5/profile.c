@@ -0,0 +1,116 @@
+#include "profile.h"
+#include "defines.h"
+#include "histogram.h"
+#include "io.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+static const char *phase_names[PHASES] = { "histogram", "tree", "codes", "coding", "rejected" };
+
+// Returns the current monotonic time in seconds.
+double profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Clears a Profile and starts its clock.
+//
+// p: profile to initialize
+// program: name printed in the profile
+void profile_init(Profile *p, const char *program) {
+    memset(p, 0, sizeof(Profile));
+    p->program = program;
+    p->mode = "dynamic";
+    p->start = profile_now();
+}
+
+// Adds the time since start to a phase.
+//
+// p: profile to update
+// phase: phase that just finished
+// start: time at which the phase started
+void profile_phase(Profile *p, Phase phase, double start) {
+    p->seconds[phase] += profile_now() - start;
+}
+
+// Returns the Shannon entropy of a histogram in bits per symbol,
+// which is the fewest bits per symbol any order-0 coder can use.
+//
+// hist: number of times each symbol appears
+double entropy(uint64_t hist[static ALPHABET]) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        total += hist[i];
+    }
+    double h = 0;
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (hist[i] > 0) {
+            double prob = (double) hist[i] / total;
+            h -= prob * log2(prob);
+        }
+    }
+    return h;
+}
+
+// Records the lowest, mean, and highest entropy of the SEEK_BLOCK
+// blocks of data, which shows how much the data changes from one
+// indexed block to the next.
+//
+// p: profile to update
+// data: symbols split into blocks
+// n: number of symbols in data
+void profile_blocks(Profile *p, const uint8_t *data, uint64_t n) {
+    uint64_t blocks = 0;
+    double sum = 0;
+    for (uint64_t first = 0; first < n; first += SEEK_BLOCK) {
+        uint64_t hist[ALPHABET] = { 0 };
+        histogram_build(data + first, n - first < SEEK_BLOCK ? n - first : SEEK_BLOCK, hist);
+        double h = entropy(hist);
+        if (blocks == 0 || h < p->block_entropy_min) {
+            p->block_entropy_min = h;
+        }
+        if (blocks == 0 || h > p->block_entropy_max) {
+            p->block_entropy_max = h;
+        }
+        sum += h;
+        blocks += 1;
+    }
+    p->block_entropy_mean = blocks ? sum / blocks : 0;
+}
+
+// Returns x divided by y, or 0 if y is 0, so that empty files do not
+// put NaN or infinity into the JSON.
+static double ratio(double x, double y) {
+    return y > 0 ? x / y : 0;
+}
+
+// Prints a profile as a single JSON object on one line. The total
+// time is measured from profile_init() up to this call.
+//
+// f: print to this file
+// p: profile to print
+void profile_print(FILE *f, Profile *p) {
+    double total = profile_now() - p->start;
+    fprintf(f, "{\"program\":\"%s\",\"mode\":\"%s\",", p->program, p->mode);
+    fprintf(f, "\"input_bytes\":%" PRIu64 ",\"output_bytes\":%" PRIu64 ",\"ratio\":%.4f,",
+        p->input_size, p->output_size, ratio(p->output_size, p->input_size));
+    fprintf(f, "\"seconds\":{\"total\":%.6f", total);
+    for (uint32_t i = 0; i < PHASES; i += 1) {
+        fprintf(f, ",\"%s\":%.6f", phase_names[i], p->seconds[i]);
+    }
+    fprintf(f, "},\"throughput_mbps\":%.2f,", ratio(p->symbols, total) / 1e6);
+    fprintf(f, "\"entropy_bits_per_symbol\":%.4f,\"bits_per_symbol\":%.4f,", p->entropy,
+        ratio(p->coded_bits, p->symbols));
+    fprintf(f, "\"block_entropy\":{\"min\":%.4f,\"mean\":%.4f,\"max\":%.4f},",
+        p->block_entropy_min, p->block_entropy_mean, p->block_entropy_max);
+    fprintf(f, "\"unique_symbols\":%" PRIu32 ",\"tree_depth\":%" PRIu32 ",", p->unique_symbols,
+        p->tree_depth);
+    fprintf(f, "\"blocks\":%" PRIu64 ",", p->blocks);
+    fprintf(f,
+        "\"syscalls\":{\"read\":%" PRIu64 ",\"write\":%" PRIu64 ",\"mmap\":%" PRIu64 "}}\n",
+        read_calls, write_calls, map_calls);
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "defines.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum { HISTOGRAM, TREE, CODES, CODING, REJECTED, PHASES } Phase;
+
+typedef struct {
+    const char *program; // Name of the program being profiled.
+    const char *mode; // How the data was coded.
+    double start; // Time at which the run started.
+    double seconds[PHASES]; // Time spent in each phase.
+    uint64_t input_size; // Bytes read.
+    uint64_t output_size; // Bytes written.
+    uint64_t symbols; // Number of symbols that were coded.
+    uint64_t coded_bits; // Bits of coded data, without headers or the tree.
+    uint64_t blocks; // Number of indexed blocks, 0 if there is no index.
+    double entropy; // Shannon entropy of the symbols in bits per symbol.
+    double block_entropy_min; // Lowest entropy of a SEEK_BLOCK block, 0 without blocks.
+    double block_entropy_mean; // Mean entropy of the SEEK_BLOCK blocks.
+    double block_entropy_max; // Highest entropy of a SEEK_BLOCK block.
+    uint32_t unique_symbols; // Distinct symbols that appear.
+    uint32_t tree_depth; // Length of the longest code.
+} Profile;
+
+double profile_now(void);
+
+void profile_init(Profile *p, const char *program);
+
+void profile_phase(Profile *p, Phase phase, double start);
+
+double entropy(uint64_t hist[static ALPHABET]);
+
+void profile_blocks(Profile *p, const uint8_t *data, uint64_t n);
+
+void profile_print(FILE *f, Profile *p);
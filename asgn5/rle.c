@@ -0,0 +1,112 @@
+#include "rle.h"
+
+#include <string.h>
+
+// Equal bytes in a row after which a run length follows.
+#define RUN 4
+
+// Run-length codes src into dst. Runs of fewer than RUN equal bytes
+// are copied as they are. A longer run is written as RUN copies of
+// the byte followed by the number of bytes left in the run, as a
+// varint of 7 bits per byte with the high bit set on all but the last
+// byte. A run of any length therefore takes at most RUN + 10 bytes.
+// dst_len holds the capacity of dst and is set to the number of bytes
+// written. Returns false if the output does not fit.
+//
+// src: bytes to code
+// n: number of bytes in src
+// dst: run-length coded bytes are written here
+// dst_len: capacity of dst, set to the number of bytes written
+bool rle_encode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t *dst_len) {
+    uint64_t size = *dst_len;
+    uint64_t j = 0;
+    for (uint64_t i = 0; i < n;) {
+        // Find the end of the run of equal bytes starting at i
+        uint64_t run = 1;
+        while (i + run < n && src[i + run] == src[i]) {
+            run += 1;
+        }
+        uint64_t copies = run < RUN ? run : RUN;
+        if (size - j < copies) {
+            return false;
+        }
+        memset(dst + j, src[i], copies);
+        j += copies;
+        if (run >= RUN) {
+            uint64_t rest = run - RUN;
+            do {
+                if (j == size) {
+                    return false;
+                }
+                dst[j++] = (rest & 0x7f) | (rest > 0x7f ? 0x80 : 0);
+                rest >>= 7;
+            } while (rest > 0);
+        }
+        i += run;
+    }
+    *dst_len = j;
+    return true;
+}
+
+// Writes count copies of a byte at position pos of the expanded data,
+// keeping only the part that falls between from and end.
+//
+// dst: bytes from up to end of the expanded data
+// from: position of the first byte of dst
+// end: position after the last byte of dst
+// pos: position of the first copy
+// byte: value that is copied
+// count: number of copies
+static inline void expand(
+    uint8_t *dst, uint64_t from, uint64_t end, uint64_t pos, uint8_t byte, uint64_t count) {
+    uint64_t lo = pos > from ? pos : from;
+    uint64_t hi = count < end - pos ? pos + count : end;
+    if (lo < hi) {
+        memset(dst + (lo - from), byte, hi - lo);
+    }
+}
+
+// Expands run-length coded src, keeping only the bytes at positions
+// from up to end of the expanded data, and stops once end is reached.
+// Returns false if src is malformed or expands to fewer than end bytes.
+//
+// src: run-length coded bytes
+// n: number of bytes in src
+// dst: bytes from up to end of the expanded data are written here
+// from: position of the first byte to keep
+// end: position after the last byte to keep
+bool rle_decode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t from, uint64_t end) {
+    uint64_t pos = 0;
+    uint8_t prev = 0;
+    uint32_t equal = 0;
+    for (uint64_t i = 0; i < n && pos < end;) {
+        uint8_t byte = src[i++];
+        equal = (equal > 0 && byte == prev) ? equal + 1 : 1;
+        prev = byte;
+        if (pos >= from) {
+            dst[pos - from] = byte;
+        }
+        pos += 1;
+        if (equal == RUN) {
+            // Read the length of the rest of the run
+            uint64_t rest = 0;
+            uint8_t b = 0;
+            for (uint32_t shift = 0; shift == 0 || (b & 0x80); shift += 7) {
+                if (i == n || shift > 63) {
+                    return false;
+                }
+                b = src[i++];
+                rest |= (uint64_t) (b & 0x7f) << shift;
+            }
+            if (rest > UINT64_MAX - pos) {
+                return false;
+            }
+            if (pos < end) {
+                expand(dst, from, end, pos, byte, rest);
+            }
+            pos += rest;
+            equal = 0;
+        }
+    }
+    return pos >= end;
+}
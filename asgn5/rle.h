@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+bool rle_encode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t *dst_len);
+
+bool rle_decode(const uint8_t *src, uint64_t n, uint8_t *dst, uint64_t from, uint64_t end);
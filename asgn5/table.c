@@ -0,0 +1,99 @@
+#include "table.h"
+#include "crc32c.h"
+#include "io.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// Builds the codes and the decoding table of a table's tree, and sets
+// its ID from the tree dump. Returns false if some symbol has no code,
+// since the table has to be able to code any input.
+//
+// t: table whose tree has been built
+// dump: dump of the tree
+// size: bytes in dump
+static bool table_finish(SharedTable *t, const uint8_t *dump, uint32_t size) {
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        t->codes[i] = code_init();
+    }
+    build_codes(&t->tree, t->codes);
+    build_table(&t->tree, &t->decode);
+    t->id = crc32c(0, dump, size);
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        if (code_empty(&t->codes[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Builds a shared table from the histogram of a training corpus. Every
+// symbol is counted at least once, so that the table can code bytes
+// that never showed up in training.
+//
+// t: table that is built
+// hist: histogram of the corpus, left unchanged
+void table_train(SharedTable *t, uint64_t hist[static ALPHABET]) {
+    uint64_t counts[ALPHABET];
+    for (uint32_t i = 0; i < ALPHABET; i += 1) {
+        counts[i] = hist[i] + 1;
+    }
+    build_tree(&t->tree, counts);
+    uint8_t dump[MAX_TREE_SIZE];
+    table_finish(t, dump, dump_tree(&t->tree, dump));
+}
+
+// Writes a table file: a TableHeader followed by the tree dump.
+// Returns the number of bytes written.
+//
+// t: table that is saved
+// buf: the table file is written here
+uint32_t table_save(SharedTable *t, uint8_t buf[static TABLE_FILE_SIZE]) {
+    uint32_t size = dump_tree(&t->tree, buf + sizeof(TableHeader));
+    TableHeader header = { .magic = MAGIC_TABLE, .id = t->id, .tree_size = size };
+    memcpy(buf, &header, sizeof(TableHeader));
+    return sizeof(TableHeader) + size;
+}
+
+// Loads a table file written by table_save(). Returns false if it is
+// not a table file, holds an invalid tree or one without every symbol,
+// or does not match its ID.
+//
+// t: table that is loaded
+// buf: the table file
+// n: number of bytes in buf
+bool table_load(SharedTable *t, const uint8_t *buf, uint64_t n) {
+    TableHeader header;
+    if (n < sizeof(TableHeader)) {
+        return false;
+    }
+    memcpy(&header, buf, sizeof(TableHeader));
+    const uint8_t *dump = buf + sizeof(TableHeader);
+    if (header.magic != MAGIC_TABLE || header.tree_size > MAX_TREE_SIZE
+        || n - sizeof(TableHeader) != header.tree_size
+        || !rebuild_tree(&t->tree, header.tree_size, dump)) {
+        return false;
+    }
+    return table_finish(t, dump, header.tree_size) && t->id == header.id;
+}
+
+// Reads and loads the table file at path. Returns false if it cannot
+// be read or is not a valid table file.
+//
+// t: table that is loaded
+// path: path of the table file
+bool table_open(SharedTable *t, const char *path) {
+    int fd = open(path, O_RDONLY);
+    Mapping m;
+    if (fd < 0 || !io_map(fd, &m)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    bool ok = table_load(t, m.data, m.size);
+    io_unmap(&m);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "code.h"
+#include "defines.h"
+#include "header.h"
+#include "huffman.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TABLE_FILE_SIZE (sizeof(TableHeader) + MAX_TREE_SIZE) // Largest table file.
+
+// Huffman table trained on a corpus and shared by the encoder and the
+// decoder, so that archives coded with it need no tree of their own.
+typedef struct {
+    uint32_t id; // CRC32C of the tree dump, recorded in archives coded with the table.
+    Tree tree;
+    Code codes[ALPHABET];
+    DecodeTable decode; // Decoding table of the tree.
+} SharedTable;
+
+void table_train(SharedTable *t, uint64_t hist[static ALPHABET]);
+
+uint32_t table_save(SharedTable *t, uint8_t buf[static TABLE_FILE_SIZE]);
+
+bool table_load(SharedTable *t, const uint8_t *buf, uint64_t n);
+
+bool table_open(SharedTable *t, const char *path);
@@ -0,0 +1,577 @@
+#include "numtheory.h"
+#include "pool.h"
+#include "randstate.h"
+#include "rsa.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OPTIONS "hr:j:"
+
+static uint64_t rounds = 3; // default number of timed rounds
+static uint32_t threads = 1; // threads for the threaded batches
+
+// Prints out the usage information and then exits the program
+void print_usage(void) {
+    fprintf(stderr, "SYNOPSIS\n"
+                    "   Benchmarks the modular exponentiation, primality test, gcd, inverse, and\n"
+                    "   signatures behind RSA. Checks every result against GMP's mpz_powm,\n"
+                    "   mpz_probab_prime_p, mpz_gcd, and mpz_invert, every signature\n"
+                    "   against rsa_verify, and a hybrid file made with e = 3 against its input.\n\n"
+                    "USAGE\n"
+                    "   ./bench [-h] [-r rounds] [-j threads]\n\n"
+                    "OPTIONS\n"
+                    "   -h              Display program help and usage.\n"
+                    "   -r rounds       Timed rounds per case (default: 3).\n"
+                    "   -j threads      Threads for the threaded batches (default: 1).\n");
+    exit(0);
+}
+
+// Returns the current time in seconds.
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Prints the rate of count operations that took best seconds.
+//
+// name: label printed with the result
+// count: number of operations
+// best: fastest time of the rounds
+// ok: whether every result was right
+static void print_rate(const char *name, uint32_t count, double best, bool ok) {
+    printf("   %-28s %10.1f ops/s  %s\n", name, count / best, ok ? "ok" : "FAILED");
+}
+
+// The right-to-left square-and-multiply that pow_mod() used to be,
+// kept as a baseline.
+//
+// o: store computed result here
+// a: base value
+// d: raise base to this power
+// n: modulo value
+static void pow_mod_legacy(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    mpz_t v, p, d_copy;
+    mpz_inits(v, p, d_copy, NULL);
+    mpz_set_ui(v, 1);
+    mpz_set(p, a);
+    mpz_set(d_copy, d);
+    while (mpz_cmp_ui(d_copy, 0) > 0) {
+        if (mpz_odd_p(d_copy) != 0) {
+            mpz_mul(v, v, p);
+            mpz_mod(v, v, n);
+        }
+        mpz_mul(p, p, p);
+        mpz_mod(p, p, n);
+        mpz_fdiv_q_ui(d_copy, d_copy, 2);
+    }
+    mpz_set(o, v);
+    mpz_clears(v, p, d_copy, NULL);
+}
+
+// Exponentiation through mont_pow() with the Montgomery form set up
+// once per modulus, the way a key that is used many times can.
+static Mont mont;
+
+static void pow_mod_mont(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    (void) n;
+    mont_pow(&mont, o, a, d);
+}
+
+// GMP's own exponentiation, the reference every result is checked
+// against.
+static void pow_mod_gmp(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    mpz_powm(o, a, d, n);
+}
+
+// Times count exponentiations of random bases with one exponentiation
+// routine and prints how many it does per second. Returns false if any
+// result differs from mpz_powm.
+//
+// name: label printed with the result
+// pow: exponentiation routine being timed
+// bases: bases to raise
+// expected: mpz_powm of each base
+// count: number of bases
+// d: exponent
+// n: modulus
+static bool bench_pow(const char *name, void (*pow)(mpz_t, mpz_t, mpz_t, mpz_t), mpz_t *bases,
+    mpz_t *expected, uint32_t count, mpz_t d, mpz_t n) {
+    mpz_t o;
+    mpz_init(o);
+    bool ok = true;
+    double best = 0;
+    for (uint64_t r = 0; r < rounds; r += 1) {
+        double start = now();
+        for (uint32_t i = 0; i < count; i += 1) {
+            pow(o, bases[i], d, n);
+            ok = ok && mpz_cmp(o, expected[i]) == 0;
+        }
+        double elapsed = now() - start;
+        best = (r == 0 || elapsed < best) ? elapsed : best;
+    }
+    print_rate(name, count, best, ok);
+    mpz_clear(o);
+    return ok;
+}
+
+// The Miller-Rabin test that is_prime() used to be, with mpz_t counters
+// and squarings through pow_mod(), kept as a baseline.
+//
+// n: odd number greater than 3 that is checked
+// iters: number of iterations
+static bool is_prime_legacy(mpz_t n, uint64_t iters) {
+    mpz_t r, s, temp, y, j, a, n_minus1, n_minus3;
+    mpz_inits(r, s, temp, y, j, a, n_minus1, n_minus3, NULL);
+    mpz_sub_ui(n_minus1, n, 1);
+    mpz_sub_ui(n_minus3, n, 3);
+    mpz_set(r, n_minus1);
+    while (mpz_even_p(r) != 0) {
+        mpz_fdiv_q_ui(r, r, 2);
+        mpz_add_ui(s, s, 1);
+    }
+    bool prime = true;
+    for (uint64_t i = 1; i <= iters && prime; i += 1) {
+        mpz_urandomm(a, state, n_minus3);
+        mpz_add_ui(a, a, 2);
+        pow_mod(y, a, r, n);
+        if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_minus1) != 0) {
+            mpz_set_ui(j, 1);
+            while (prime && mpz_cmp(j, s) < 0 && mpz_cmp(y, n_minus1) != 0) {
+                mpz_set_ui(temp, 2);
+                pow_mod(y, y, temp, n);
+                prime = mpz_cmp_ui(y, 1) != 0;
+                mpz_add_ui(j, j, 1);
+            }
+            prime = prime && mpz_cmp(y, n_minus1) == 0;
+        }
+    }
+    mpz_clears(r, s, temp, y, j, a, n_minus1, n_minus3, NULL);
+    return prime;
+}
+
+// Times one primality test on count numbers and prints how many it
+// checks per second. Returns false if any answer differs from
+// mpz_probab_prime_p.
+//
+// name: label printed with the result
+// test: primality test being timed
+// numbers: numbers to check
+// expected: whether each number is prime
+// count: number of numbers
+// iters: Miller-Rabin iterations
+static bool bench_prime(const char *name, bool (*test)(mpz_t, uint64_t), mpz_t *numbers,
+    bool *expected, uint32_t count, uint64_t iters) {
+    bool ok = true;
+    double best = 0;
+    for (uint64_t r = 0; r < rounds; r += 1) {
+        double start = now();
+        for (uint32_t i = 0; i < count; i += 1) {
+            ok = test(numbers[i], iters) == expected[i] && ok;
+        }
+        double elapsed = now() - start;
+        best = (r == 0 || elapsed < best) ? elapsed : best;
+    }
+    print_rate(name, count, best, ok);
+    return ok;
+}
+
+// Benchmarks is_prime() against the old Miller-Rabin on random odd
+// numbers of bits bits, which are mostly composite as when searching
+// for a prime, and on primes, which take every iteration. is_prime()
+// is also timed with the PRIME_ITERS rounds that keygen runs.
+//
+// bits: length of the numbers
+// iters: Miller-Rabin iterations
+static bool bench_primes(uint64_t bits, uint64_t iters) {
+    const uint32_t count = 64;
+    mpz_t odd[count], primes[count];
+    bool odd_prime[count], all_prime[count];
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_inits(odd[i], primes[i], NULL);
+        mpz_urandomb(odd[i], state, bits);
+        mpz_setbit(odd[i], bits - 1);
+        mpz_setbit(odd[i], 0);
+        odd_prime[i] = mpz_probab_prime_p(odd[i], 30) != 0;
+        mpz_nextprime(primes[i], odd[i]);
+        all_prime[i] = true;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "is_prime, %u iterations", PRIME_ITERS);
+    bool ok = true;
+    printf("is_prime (%" PRIu64 "-bit random odd numbers, %" PRIu64 " iterations)\n", bits, iters);
+    ok = bench_prime("Miller-Rabin (old)", is_prime_legacy, odd, odd_prime, count, iters) && ok;
+    ok = bench_prime("is_prime", is_prime, odd, odd_prime, count, iters) && ok;
+    ok = bench_prime(name, is_prime, odd, odd_prime, count, PRIME_ITERS) && ok;
+    printf("is_prime (%" PRIu64 "-bit primes, %" PRIu64 " iterations)\n", bits, iters);
+    ok = bench_prime("Miller-Rabin (old)", is_prime_legacy, primes, all_prime, count, iters) && ok;
+    ok = bench_prime("is_prime", is_prime, primes, all_prime, count, iters) && ok;
+    ok = bench_prime(name, is_prime, primes, all_prime, count, PRIME_ITERS) && ok;
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clears(odd[i], primes[i], NULL);
+    }
+    return ok;
+}
+
+// The Euclid with a division per step that gcd() used to be, kept as a
+// baseline.
+//
+// g: store computed result here
+// a and b: find gcd of these two numbers
+static void gcd_legacy(mpz_t g, mpz_t a, mpz_t b) {
+    mpz_t x, y;
+    mpz_init_set(x, a);
+    mpz_init_set(y, b);
+    while (mpz_sgn(y) != 0) {
+        mpz_mod(x, x, y);
+        mpz_swap(x, y);
+    }
+    mpz_set(g, x);
+    mpz_clears(x, y, NULL);
+}
+
+// The extended Euclid with a division per step that mod_inverse() used
+// to be, kept as a baseline.
+//
+// o: modular inverse stored here, or 0 if there is none
+// a: base value
+// n: modulo value
+static void mod_inverse_legacy(mpz_t o, mpz_t a, mpz_t n) {
+    mpz_t r, r_prime, t, t_prime, q;
+    mpz_inits(r, r_prime, t, t_prime, q, NULL);
+    mpz_set(r, n);
+    mpz_set(r_prime, a);
+    mpz_set_ui(t_prime, 1);
+    while (mpz_sgn(r_prime) != 0) {
+        mpz_fdiv_q(q, r, r_prime);
+        mpz_submul(r, q, r_prime);
+        mpz_swap(r, r_prime);
+        mpz_submul(t, q, t_prime);
+        mpz_swap(t, t_prime);
+    }
+    if (mpz_cmp_ui(r, 1) > 0) {
+        mpz_set_ui(t, 0);
+    } else if (mpz_sgn(t) < 0) {
+        mpz_add(t, t, n);
+    }
+    mpz_set(o, t);
+    mpz_clears(r, r_prime, t, t_prime, q, NULL);
+}
+
+// GMP's own gcd, the reference every gcd is checked against.
+static void gcd_gmp(mpz_t g, mpz_t a, mpz_t b) {
+    mpz_gcd(g, a, b);
+}
+
+// GMP's own inverse, with 0 when there is none as mod_inverse() does.
+static void mod_inverse_gmp(mpz_t o, mpz_t a, mpz_t n) {
+    if (!mpz_invert(o, a, n)) {
+        mpz_set_ui(o, 0);
+    }
+}
+
+// Times one gcd or inverse routine on count pairs and prints how many
+// it does per second. Returns false if any result differs from GMP's.
+//
+// name: label printed with the result
+// op: routine being timed
+// x and y: operands of each pair
+// expected: GMP's result for each pair
+// count: number of pairs
+static bool bench_pair(const char *name, void (*op)(mpz_t, mpz_t, mpz_t), mpz_t *x, mpz_t *y,
+    mpz_t *expected, uint32_t count) {
+    mpz_t o;
+    mpz_init(o);
+    bool ok = true;
+    double best = 0;
+    for (uint64_t r = 0; r < rounds; r += 1) {
+        double start = now();
+        for (uint32_t i = 0; i < count; i += 1) {
+            op(o, x[i], y[i]);
+            ok = ok && mpz_cmp(o, expected[i]) == 0;
+        }
+        double elapsed = now() - start;
+        best = (r == 0 || elapsed < best) ? elapsed : best;
+    }
+    print_rate(name, count, best, ok);
+    mpz_clear(o);
+    return ok;
+}
+
+// Benchmarks gcd() and mod_inverse() against the old Euclid and GMP on
+// random numbers of bits bits, as rsa_make_pub() and rsa_make_priv()
+// use them.
+//
+// bits: length of the numbers
+static bool bench_gcds(uint64_t bits) {
+    uint32_t count = 4096 / (bits / 512);
+    mpz_t *x = (mpz_t *) malloc(count * sizeof(mpz_t));
+    mpz_t *y = (mpz_t *) malloc(count * sizeof(mpz_t));
+    mpz_t *g = (mpz_t *) malloc(count * sizeof(mpz_t));
+    mpz_t *inv = (mpz_t *) malloc(count * sizeof(mpz_t));
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_inits(x[i], y[i], g[i], inv[i], NULL);
+        mpz_urandomb(x[i], state, bits);
+        mpz_urandomb(y[i], state, bits);
+        mpz_setbit(y[i], bits - 1);
+        mpz_mod(x[i], x[i], y[i]);
+        mpz_gcd(g[i], x[i], y[i]);
+        mod_inverse_gmp(inv[i], x[i], y[i]);
+    }
+
+    bool ok = true;
+    printf("gcd (%" PRIu64 "-bit numbers)\n", bits);
+    ok = bench_pair("Euclid (old)", gcd_legacy, x, y, g, count) && ok;
+    ok = bench_pair("gcd", gcd, x, y, g, count) && ok;
+    ok = bench_pair("mpz_gcd", gcd_gmp, x, y, g, count) && ok;
+    printf("mod_inverse (%" PRIu64 "-bit modulus)\n", bits);
+    ok = bench_pair("extended Euclid (old)", mod_inverse_legacy, x, y, inv, count) && ok;
+    ok = bench_pair("mod_inverse", mod_inverse, x, y, inv, count) && ok;
+    ok = bench_pair("mpz_invert", mod_inverse_gmp, x, y, inv, count) && ok;
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clears(x[i], y[i], g[i], inv[i], NULL);
+    }
+    free(x);
+    free(y);
+    free(g);
+    free(inv);
+    return ok;
+}
+
+// Benchmarks signing and verifying count random messages with a new key
+// of bits bits: one at a time with rsa_sign() and rsa_verify(), and as
+// batches on the caller and on the threads of pool.
+//
+// bits: length of n
+// count: number of messages
+// exponent: fixed public exponent, or 0 for a random one
+// pool: threads for the threaded batches
+static bool bench_signatures(uint64_t bits, uint32_t count, uint64_t exponent, Pool *pool) {
+    mpz_t p, q, n, e;
+    mpz_inits(p, q, n, e, NULL);
+    PrivKey key;
+    rsa_priv_init(&key);
+    rsa_make_pub(p, q, n, e, bits, 25, exponent, pool);
+    rsa_make_priv(&key, e, p, q);
+
+    mpz_t *m = (mpz_t *) malloc(count * sizeof(mpz_t));
+    mpz_t *s = (mpz_t *) malloc(count * sizeof(mpz_t));
+    bool *valid = (bool *) malloc(count * sizeof(bool));
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_inits(m[i], s[i], NULL);
+        mpz_urandomm(m[i], state, n);
+    }
+
+    printf("signatures (%" PRIu64 "-bit n, %zu-bit e)\n", bits, mpz_sizeinbase(e, 2));
+    bool ok = true;
+    const char *names[] = { "rsa_sign", "rsa_sign_batch", "rsa_sign_batch, threads" };
+    for (uint32_t mode = 0; mode < 3; mode += 1) {
+        double best = 0;
+        for (uint64_t r = 0; r < rounds; r += 1) {
+            for (uint32_t i = 0; i < count; i += 1) {
+                mpz_set_ui(s[i], 0);
+            }
+            double start = now();
+            if (mode == 0) {
+                for (uint32_t i = 0; i < count; i += 1) {
+                    rsa_sign(s[i], m[i], &key);
+                }
+            } else {
+                rsa_sign_batch(s, m, count, &key, mode == 2 ? pool : NULL);
+            }
+            double elapsed = now() - start;
+            best = (r == 0 || elapsed < best) ? elapsed : best;
+        }
+        bool right = true;
+        for (uint32_t i = 0; i < count; i += 1) {
+            right = rsa_verify(m[i], s[i], e, n) && right;
+        }
+        print_rate(names[mode], count, best, right);
+        ok = ok && right;
+    }
+
+    // Every other signature is spoiled so that verifying has to reject it
+    for (uint32_t i = 0; i < count; i += 2) {
+        mpz_add_ui(s[i], s[i], 1);
+    }
+    names[0] = "rsa_verify";
+    names[1] = "rsa_verify_batch";
+    names[2] = "rsa_verify_batch, threads";
+    for (uint32_t mode = 0; mode < 3; mode += 1) {
+        double best = 0;
+        bool right = true;
+        for (uint64_t r = 0; r < rounds; r += 1) {
+            double start = now();
+            if (mode == 0) {
+                for (uint32_t i = 0; i < count; i += 1) {
+                    valid[i] = rsa_verify(m[i], s[i], e, n);
+                }
+            } else {
+                rsa_verify_batch(valid, m, s, count, e, n, mode == 2 ? pool : NULL);
+            }
+            double elapsed = now() - start;
+            best = (r == 0 || elapsed < best) ? elapsed : best;
+            for (uint32_t i = 0; i < count; i += 1) {
+                right = right && valid[i] == (i % 2 == 1);
+            }
+        }
+        print_rate(names[mode], count, best, right);
+        ok = ok && right;
+    }
+
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clears(m[i], s[i], NULL);
+    }
+    free(m);
+    free(s);
+    free(valid);
+    rsa_priv_clear(&key);
+    mpz_clears(p, q, n, e, NULL);
+    return ok;
+}
+
+// Checks that a hybrid file made with a key of bits bits and e = 3
+// decrypts back to its input, and that its session block wraps around
+// n, which an exact cube root of the block would show it does not.
+//
+// bits: length of n
+// bytes: bytes of random data that are encrypted
+// pool: threads that encrypt and decrypt the data
+static bool check_hybrid(uint64_t bits, size_t bytes, Pool *pool) {
+    mpz_t p, q, n, e, c, root;
+    mpz_inits(p, q, n, e, c, root, NULL);
+    PrivKey key;
+    rsa_priv_init(&key);
+    rsa_make_pub(p, q, n, e, bits, 25, 3, pool);
+    rsa_make_priv(&key, e, p, q);
+
+    uint8_t *data = (uint8_t *) malloc(bytes);
+    uint8_t *back = (uint8_t *) malloc(bytes + 1);
+    for (size_t i = 0; i < bytes; i += 1) {
+        data[i] = gmp_urandomb_ui(state, 8);
+    }
+    FILE *plain = tmpfile();
+    FILE *cipher = tmpfile();
+    FILE *decrypted = tmpfile();
+    bool ok = data && back && plain && cipher && decrypted;
+    if (ok) {
+        fwrite(data, sizeof(uint8_t), bytes, plain);
+        rewind(plain);
+        ok = rsa_encrypt_file_hybrid(plain, cipher, n, e, pool);
+    }
+
+    // The session block follows the 12-byte header
+    size_t width = (mpz_sizeinbase(n, 2) + 7) / 8;
+    uint8_t *block = (uint8_t *) malloc(width);
+    if (ok) {
+        ok = block && fseek(cipher, 12, SEEK_SET) == 0
+             && fread(block, sizeof(uint8_t), width, cipher) == width;
+    }
+    if (ok) {
+        mpz_import(c, width, 1, sizeof(uint8_t), 1, 0, block);
+        ok = mpz_root(root, c, 3) == 0;
+        rewind(cipher);
+        ok = rsa_decrypt_file(cipher, decrypted, &key, pool) && ok;
+    }
+    if (ok) {
+        rewind(decrypted);
+        ok = fread(back, sizeof(uint8_t), bytes + 1, decrypted) == bytes
+             && memcmp(back, data, bytes) == 0;
+    }
+    printf("hybrid round trip (%" PRIu64 "-bit n, e = 3)\n", bits);
+    printf("   %-28s %10zu bytes  %s\n", "encrypt -s, decrypt", bytes, ok ? "ok" : "FAILED");
+
+    FILE *files[] = { plain, cipher, decrypted };
+    for (uint32_t i = 0; i < 3; i += 1) {
+        if (files[i]) {
+            fclose(files[i]);
+        }
+    }
+    free(block);
+    free(data);
+    free(back);
+    rsa_priv_clear(&key);
+    mpz_clears(p, q, n, e, c, root, NULL);
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    int opt = 0;
+    while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
+        switch (opt) {
+        case 'r': rounds = strtoull(optarg, NULL, 10); break;
+        case 'j': threads = strtoul(optarg, NULL, 10); break;
+        case 'h': print_usage(); break;
+        default: print_usage(); break;
+        }
+    }
+    if (rounds == 0 || threads < 1 || threads > 1024) {
+        print_usage();
+    }
+    randstate_init(13371453);
+
+    bool ok = true;
+    const uint64_t sizes[] = { 512, 1024, 2048, 4096 };
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s += 1) {
+        uint64_t bits = sizes[s];
+        // Fewer operations at the larger sizes keep every case short
+        uint32_t count = 16384 / (bits / 64) / (bits / 512);
+
+        // A random odd modulus and a full-size exponent, as in decryption
+        mpz_t n, d;
+        mpz_inits(n, d, NULL);
+        mpz_urandomb(n, state, bits);
+        mpz_setbit(n, bits - 1);
+        mpz_setbit(n, 0);
+        mpz_urandomm(d, state, n);
+        mpz_t *bases = (mpz_t *) malloc(count * sizeof(mpz_t));
+        mpz_t *expected = (mpz_t *) malloc(count * sizeof(mpz_t));
+        for (uint32_t i = 0; i < count; i += 1) {
+            mpz_inits(bases[i], expected[i], NULL);
+            mpz_urandomm(bases[i], state, n);
+            mpz_powm(expected[i], bases[i], d, n);
+        }
+
+        printf("pow_mod (%" PRIu64 "-bit modulus and exponent)\n", bits);
+        mont_init(&mont, n);
+        ok = bench_pow("square-and-multiply (old)", pow_mod_legacy, bases, expected, count, d, n)
+             && ok;
+        ok = bench_pow("pow_mod", pow_mod, bases, expected, count, d, n) && ok;
+        ok = bench_pow("mont_pow, shared Mont", pow_mod_mont, bases, expected, count, d, n) && ok;
+        ok = bench_pow("mpz_powm", pow_mod_gmp, bases, expected, count, d, n) && ok;
+        mont_clear(&mont);
+
+        for (uint32_t i = 0; i < count; i += 1) {
+            mpz_clears(bases[i], expected[i], NULL);
+        }
+        free(bases);
+        free(expected);
+        mpz_clears(n, d, NULL);
+    }
+    ok = bench_primes(512, 50) && ok;
+    ok = bench_primes(1024, 50) && ok;
+    for (uint64_t bits = 512; bits <= 8192; bits *= 2) {
+        ok = bench_gcds(bits) && ok;
+    }
+
+    Pool *pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Error: failed to start %u threads.\n", threads);
+        exit(1);
+    }
+    ok = bench_signatures(1024, 256, 65537, pool) && ok;
+    ok = bench_signatures(2048, 64, 65537, pool) && ok;
+    ok = bench_signatures(2048, 64, 0, pool) && ok;
+    ok = bench_signatures(4096, 16, 65537, pool) && ok;
+    ok = check_hybrid(1024, 3 * 1000 * 1000, pool) && ok;
+    pool_delete(&pool);
+    randstate_clear();
+    return ok ? 0 : 1;
+}
@@ -7,20 +7,21 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:j:vh"
 
 void print_usage(void) {
     fprintf(stderr, "SYNOPSIS\n"
                     "   Decrypts data using RSA encryption.\n"
                     "   Encrypted data is encrypted by the encrypt program.\n\n"
                     "USAGE\n"
-                    "   ./decrypt [-hv] [-i infile] [-o outfile] -n privkey\n\n"
+                    "   ./decrypt [-hv] [-i infile] [-o outfile] -n privkey [-j threads]\n\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
                     "   -i infile       Input file of data to decrypt (default: stdin).\n"
                     "   -o outfile      Output file for decrypted data (default: stdout).\n"
-                    "   -n pvfile       Private key file (default: rsa.priv).\n");
+                    "   -n pvfile       Private key file (default: rsa.priv).\n"
+                    "   -j threads      Threads that decrypt blocks (default: 1).\n");
     exit(0);
 }
 
@@ -33,6 +34,7 @@ int main(int argc, char **argv) {
     int opt = 0;
     bool verbose = false;
     bool help = false;
+    uint32_t threads = 1;
     bool i = false;
     bool o = false;
     FILE *infile = stdin;
@@ -53,13 +55,14 @@ int main(int argc, char **argv) {
             out = optarg;
             break;
         case 'n': priv = optarg; break;
+        case 'j': threads = atoi(optarg); break;
         case 'v': verbose = true; break;
         case 'h': help = true; break;
         default: help = true; break;
         }
     }
     // If help option is enabled, print the usage guide
-    if (help) {
+    if (help || threads < 1 || threads > 1024) {
         print_usage();
     }
 
@@ -75,21 +78,30 @@ int main(int argc, char **argv) {
     pvfile = fopen(priv, "r");
 
     // Initialize variables and read from private key file
-    // n: public modulus
-    // d: private key
-    mpz_t n, d;
-    mpz_inits(n, d, NULL);
-    rsa_read_priv(n, d, pvfile);
+    // key: private key, with n and d
+    PrivKey key;
+    rsa_priv_init(&key);
+    rsa_read_priv(&key, pvfile);
 
     // If verbose option is enabled, print verbose output
     if (verbose) {
-        print_verbose(n, d);
+        print_verbose(key.n, key.d);
     }
 
-    // Decrypt the file
-    rsa_decrypt_file(infile, outfile, n, d);
+    // Decrypt the file, in either ciphertext format, with threads
+    // threads sharing the blocks
+    Pool *pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Error: failed to start %u threads.\n", threads);
+        exit(1);
+    }
+    if (!rsa_decrypt_file(infile, outfile, &key, pool)) {
+        fprintf(stderr, "Error: ciphertext is corrupted or not for this key.\n");
+        exit(1);
+    }
 
-    // Close the private key file and clear mpz_t variables
+    // Stop the threads, close the private key file and clear mpz_t variables
+    pool_delete(&pool);
     fclose(pvfile);
-    mpz_clears(n, d, NULL);
+    rsa_priv_clear(&key);
 }
@@ -8,20 +8,24 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
-#define OPTIONS "i:o:n:vh"
+#define OPTIONS "i:o:n:j:sxvh"
 
 void print_usage(void) {
     fprintf(stderr, "SYNOPSIS\n"
                     "   Encrypts data using RSA encryption.\n"
                     "   Encrypted data is decrypted by the decrypt program.\n\n"
                     "USAGE\n"
-                    "   ./encrypt [-hv] [-i infile] [-o outfile] [-n pubkey]\n\n"
+                    "   ./encrypt [-hvsx] [-i infile] [-o outfile] [-n pubkey] [-j threads]\n\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
+                    "   -x              Write hexstring lines instead of binary blocks.\n"
+                    "   -s              Wrap a random session key with RSA and encrypt the data\n"
+                    "                   with SPECK in counter mode, for large files.\n"
                     "   -i infile       Input file of data to encrypt (default: stdin).\n"
                     "   -o outfile      Output file for encrypted data (default: stdout).\n"
-                    "   -n pbfile       Public key file (default: rsa.pub).\n");
+                    "   -n pbfile       Public key file (default: rsa.pub).\n"
+                    "   -j threads      Threads that encrypt blocks (default: 1).\n");
     exit(0);
 }
 
@@ -36,6 +40,9 @@ int main(int argc, char **argv) {
     int opt = 0;
     bool verbose = false;
     bool help = false;
+    uint32_t threads = 1;
+    bool hex = false;
+    bool hybrid = false;
     bool i = false;
     bool o = false;
     FILE *infile = stdin;
@@ -56,13 +63,16 @@ int main(int argc, char **argv) {
             out = optarg;
             break;
         case 'n': pub = optarg; break;
+        case 'x': hex = true; break;
+        case 's': hybrid = true; break;
+        case 'j': threads = atoi(optarg); break;
         case 'v': verbose = true; break;
         case 'h': help = true; break;
         default: help = true; break;
         }
     }
     // If help option is enabled, print the usage guide
-    if (help) {
+    if (help || threads < 1 || threads > 1024 || (hex && hybrid)) {
         print_usage();
     }
 
@@ -100,10 +110,28 @@ int main(int argc, char **argv) {
         exit(0);
     }
 
-    // Encrypt the file
-    rsa_encrypt_file(infile, outfile, n, e);
+    // Encrypt the file, with threads threads sharing the blocks
+    Pool *pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Error: failed to start %u threads.\n", threads);
+        exit(1);
+    }
+    bool ok = true;
+    if (hex) {
+        rsa_encrypt_file_hex(infile, outfile, n, e);
+    } else if (hybrid) {
+        ok = rsa_encrypt_file_hybrid(infile, outfile, n, e, pool);
+    } else {
+        rsa_encrypt_file(infile, outfile, n, e, pool);
+    }
+    if (!ok) {
+        fprintf(stderr, "Error: failed to make a session key (key under 201 bits or no "
+                        "/dev/urandom).\n");
+        exit(1);
+    }
 
-    // Close the public key file and clear mpz_t variables
+    // Stop the threads, close the public key file and clear mpz_t variables
+    pool_delete(&pool);
     fclose(pbfile);
     mpz_clears(n, e, s, user, NULL);
 }
@@ -1,5 +1,7 @@
+#include "numtheory.h"
 #include "randstate.h"
 #include "rsa.h"
+#include "pool.h"
 
 #include <stdio.h>
 #include <inttypes.h>
@@ -9,25 +11,30 @@
 #include <stdbool.h>
 #include <sys/stat.h>
 
-#define OPTIONS "b:i:n:d:s:vh"
+#define OPTIONS "b:i:n:d:s:j:e:vh"
 
 static uint64_t nbits = 256;
-static uint64_t iters = 50;
+static uint64_t iters = PRIME_ITERS;
 static uint64_t seed;
+static uint64_t exponent = 0;
 
 void print_usage(void) {
     fprintf(stderr, "SYNOPSIS\n"
                     "   Generates an RSA public/private key pair.\n\n"
                     "USAGE\n"
-                    "   ./keygen [-hv] [-b bits] [-i iters] [-n pbfile] [-d pvfile]\n\n"
+                    "   ./keygen [-hv] [-b bits] [-i iters] [-n pbfile] [-d pvfile] [-s seed] [-j threads]\n"
+                    "            [-e exponent]\n\n"
                     "OPTIONS\n"
                     "   -h              Display program help and usage.\n"
                     "   -v              Display verbose program output.\n"
                     "   -b bits         Minimum bits needed for public key n.\n"
-                    "   -i iters        Miller-Rabin iterations for testing primes (default: 50).\n"
+                    "   -i iters        Miller-Rabin iterations after Baillie-PSW (default: 4).\n"
                     "   -n pbfile       Public key file (default: rsa.pub).\n"
                     "   -d pvfile       Private key file (default: rsa.priv).\n"
-                    "   -s seed         Random seed for testing.\n");
+                    "   -s seed         Random seed for testing.\n"
+                    "   -j threads      Threads that search for primes (default: 1).\n"
+                    "   -e exponent     Fixed odd public exponent of at least 65537, since blocks\n"
+                    "                   are not padded (default: random).\n");
     exit(0);
 }
 
@@ -50,6 +57,7 @@ int main(int argc, char **argv) {
     FILE *pvfile;
     char *pub = "rsa.pub";
     char *priv = "rsa.priv";
+    uint32_t threads = 1;
 
     while ((opt = getopt(argc, argv, OPTIONS)) != -1) {
         switch (opt) {
@@ -58,6 +66,8 @@ int main(int argc, char **argv) {
         case 'n': pub = optarg; break;
         case 'd': priv = optarg; break;
         case 's': seed = atoi(optarg); break;
+        case 'j': threads = atoi(optarg); break;
+        case 'e': exponent = strtoull(optarg, NULL, 10); break;
         case 'v': verbose = true; break;
         case 'h': help = true; break;
         case '?': help = true; break;
@@ -71,7 +81,8 @@ int main(int argc, char **argv) {
     fchmod(fileno(pvfile), 0600);
 
     // If help option is enabled, print the usage guide
-    if (help) {
+    bool bad_exponent = exponent != 0 && (exponent < MIN_EXPONENT || exponent % 2 == 0);
+    if (help || threads < 1 || threads > 1024 || bad_exponent) {
         print_usage();
     }
 
@@ -82,30 +93,37 @@ int main(int argc, char **argv) {
     // p and q: large prime numbers
     // n: product of p and q
     // e: public exponent
-    // d: private key
-    mpz_t p, q, n, e, d;
-    mpz_inits(p, q, n, e, d, NULL);
-    rsa_make_pub(p, q, n, e, nbits, iters);
-    rsa_make_priv(d, e, p, q);
+    // key: private key
+    mpz_t p, q, n, e;
+    mpz_inits(p, q, n, e, NULL);
+    PrivKey key;
+    rsa_priv_init(&key);
+    Pool *pool = pool_create(threads);
+    if (!pool) {
+        fprintf(stderr, "Error: failed to start %u threads.\n", threads);
+        exit(1);
+    }
+    rsa_make_pub(p, q, n, e, nbits, iters, exponent, pool);
+    pool_delete(&pool);
+    rsa_make_priv(&key, e, p, q);
 
     // Get the current user's name as a string
     char *username = getenv("USER");
     // Convert the username to mpz_t and then compute the signature
     // s: signature
-    // d: private key
-    // n: public modulus
+    // key: private key
     mpz_t user, s;
     mpz_inits(user, s, NULL);
     mpz_set_str(user, username, 62);
-    rsa_sign(s, user, d, n);
+    rsa_sign(s, user, &key);
 
     // Write the public and private key to respective file
     rsa_write_pub(n, e, s, username, pbfile);
-    rsa_write_priv(n, d, pvfile);
+    rsa_write_priv(&key, pvfile);
 
     // If verbose option is enabled, print verbose output
     if (verbose) {
-        print_verbose(username, s, p, q, n, e, d);
+        print_verbose(username, s, p, q, n, e, key.d);
     }
 
     // Close the public and private key files
@@ -116,5 +134,6 @@ int main(int argc, char **argv) {
     randstate_clear();
 
     // Clear mpz_t variables
-    mpz_clears(p, q, n, e, d, user, s, NULL);
+    mpz_clears(p, q, n, e, user, s, NULL);
+    rsa_priv_clear(&key);
 }
@@ -1,206 +1,1024 @@
 #include "numtheory.h"
 #include "randstate.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
+#define SIEVE_LIMIT  65536 // Candidates are sieved by the odd primes below this.
+#define SIEVE_PRIMES 6541 // Number of odd primes below SIEVE_LIMIT.
+#define SIEVE_SPAN   32768 // Odd numbers in the window of each prime search.
+
 gmp_randstate_t state;
 
+// Which scratch numbers of a NumCtx each function uses. A function
+// never uses the numbers of the functions it calls.
+#define T_BASE   0 // mont_pow_ctx(), mont_pow_ui_ctx(), and ctx_mont().
+#define T_POW    1 // pow_mod_ctx() square-and-multiply, 2 numbers.
+#define T_GCD    1 // gcd_ctx(), 4 numbers.
+#define T_INV    0 // mod_inverse_ctx(), 7 numbers.
+#define T_PRIME  1 // is_prime_ctx(), 5 numbers.
+#define T_LUCAS  6 // lucas_probable_prime(), 1 number.
+
+// Returns count zeroed items of size bytes each. Prints an error and
+// exits if they cannot be allocated, as the limb arithmetic has no
+// way to hand a failure back to its callers.
+//
+// count: number of items
+// size: bytes in each item
+void *num_alloc(size_t count, size_t size) {
+    void *p = calloc(count, size);
+    if (!p) {
+        fprintf(stderr, "Error: failed to allocate %zu bytes.\n", count * size);
+        exit(1);
+    }
+    return p;
+}
+
+// Sets up an empty scratch context. Nothing is allocated until it is
+// used.
+//
+// c: context to set up
+void num_ctx_init(NumCtx *c) {
+    for (uint32_t i = 0; i < NUM_TEMPS; i += 1) {
+        mpz_init(c->t[i]);
+    }
+    mpz_init(c->modulus);
+    c->limbs = c->mont_limbs = NULL;
+    c->size = c->mont_size = 0;
+    c->mont.size = 0;
+}
+
+// Frees everything a scratch context has allocated.
+//
+// c: context to clear
+void num_ctx_clear(NumCtx *c) {
+    for (uint32_t i = 0; i < NUM_TEMPS; i += 1) {
+        mpz_clear(c->t[i]);
+    }
+    mpz_clear(c->modulus);
+    free(c->limbs);
+    free(c->mont_limbs);
+    c->limbs = c->mont_limbs = NULL;
+    c->size = c->mont_size = 0;
+    c->mont.size = 0;
+}
+
+// Returns at least count scratch limbs of a context, growing them if
+// they are too few. The limbs are shared by every function, so only
+// one may use them at a time.
+//
+// c: context
+// count: limbs needed
+static mp_limb_t *ctx_limbs(NumCtx *c, size_t count) {
+    if (count > c->size) {
+        free(c->limbs);
+        c->limbs = (mp_limb_t *) num_alloc(count, sizeof(mp_limb_t));
+        c->size = count;
+    }
+    return c->limbs;
+}
+
+// Bits of the leading parts of numbers in Lehmer's algorithm. Two
+// below the word size, so cofactor sums never overflow an int64_t.
+#define LEHMER_BITS 62
+
+// Returns the LEHMER_BITS bits of x starting at bit shift. x must be
+// below 2^(shift + LEHMER_BITS).
+//
+// x: number to take the bits of
+// shift: lowest bit to take
+static int64_t lead_bits(mpz_t x, mp_bitcnt_t shift) {
+    size_t i = shift / GMP_NUMB_BITS;
+    uint32_t off = shift % GMP_NUMB_BITS;
+    mp_limb_t w = mpz_getlimbn(x, i) >> off;
+    if (off > 0) {
+        w |= mpz_getlimbn(x, i + 1) << (GMP_NUMB_BITS - off);
+    }
+    return (int64_t) w;
+}
+
+// Sets o = p * x + q * y. o must not be x or y.
+//
+// o: store the result here
+// x and y: numbers to combine
+// p and q: multipliers of x and y
+static void combine(mpz_t o, mpz_t x, int64_t p, mpz_t y, int64_t q) {
+    mpz_mul_si(o, x, p);
+    if (q >= 0) {
+        mpz_addmul_ui(o, y, (uint64_t) q);
+    } else {
+        mpz_submul_ui(o, y, -(uint64_t) q);
+    }
+}
+
+// Runs Euclid on the leading bits of r and r_prime for as long as its
+// quotients are certain to be those of r and r_prime, and stores the
+// product of the steps in m as [m[0] m[1]; m[2] m[3]]. Returns false if
+// not even one quotient was certain. r must be at least r_prime, and
+// r_prime must need more than a limb.
+//
+// m: store the step matrix here
+// r and r_prime: remainders to step on
+static bool lehmer_matrix(int64_t m[4], mpz_t r, mpz_t r_prime) {
+    mp_bitcnt_t shift = mpz_sizeinbase(r, 2) - LEHMER_BITS;
+    int64_t x = lead_bits(r, shift), y = lead_bits(r_prime, shift);
+    int64_t A = 1, B = 0, C = 0, D = 1;
+    while (y + C != 0 && y + D != 0) {
+        int64_t k = (x + A) / (y + C);
+        if (k != (x + B) / (y + D)) {
+            break;
+        }
+        int64_t s = A - k * C;
+        A = C;
+        C = s;
+        s = B - k * D;
+        B = D;
+        D = s;
+        s = x - k * y;
+        x = y;
+        y = s;
+    }
+    m[0] = A;
+    m[1] = B;
+    m[2] = C;
+    m[3] = D;
+    return B != 0;
+}
+
+// Sets (x, y) = (m[0] x + m[1] y, m[2] x + m[3] y).
+//
+// m: step matrix from lehmer_matrix()
+// x and y: numbers to step
+// u and v: scratch numbers
+static void lehmer_apply(int64_t m[4], mpz_t x, mpz_t y, mpz_t u, mpz_t v) {
+    combine(u, x, m[0], y, m[1]);
+    combine(v, x, m[2], y, m[3]);
+    mpz_swap(x, u);
+    mpz_swap(y, v);
+}
+
+// Returns the greatest common divisor of two limbs with the binary
+// gcd: the smaller of two odd numbers is subtracted from the larger,
+// and the zeros of the even difference are shifted out.
+//
+// u and v: numbers to find the gcd of
+static mp_limb_t gcd_limb(mp_limb_t u, mp_limb_t v) {
+    if (u == 0 || v == 0) {
+        return u | v;
+    }
+    // gcd(2^i u, 2^j v) = 2^min(i, j) gcd(u, v) for odd u and v
+    uint32_t shift = __builtin_ctzl(u | v);
+    u >>= __builtin_ctzl(u);
+    v >>= __builtin_ctzl(v);
+    while (u != v) {
+        if (u > v) {
+            mp_limb_t s = u;
+            u = v;
+            v = s;
+        }
+        v -= u;
+        v >>= __builtin_ctzl(v);
+    }
+    return u << shift;
+}
+
+// Computes the greatest common divisor between a and b,
+// and stores the value in g.
+//
+// Lehmer steps shorten the numbers until the smaller fits a limb, and
+// the binary gcd on limbs finishes them.
+//
+// c: scratch context
+// g: store computed result here
+// a and b: find gcd of these two numbers
+void gcd_ctx(NumCtx *c, mpz_t g, mpz_t a, mpz_t b) {
+    mpz_ptr r = c->t[T_GCD], r_prime = c->t[T_GCD + 1];
+    mpz_ptr u = c->t[T_GCD + 2], v = c->t[T_GCD + 3];
+    mpz_abs(r, a);
+    mpz_abs(r_prime, b);
+    if (mpz_cmp(r, r_prime) < 0) {
+        mpz_swap(r, r_prime);
+    }
+
+    int64_t m[4];
+    while (mpz_size(r_prime) > 1) {
+        if (lehmer_matrix(m, r, r_prime)) {
+            lehmer_apply(m, r, r_prime, u, v);
+        } else {
+            // No quotient was certain, so take one full Euclid step
+            mpz_mod(r, r, r_prime);
+            mpz_swap(r, r_prime);
+        }
+    }
+
+    // gcd(r, 0) = r
+    if (mpz_sgn(r_prime) == 0) {
+        mpz_set(g, r);
+        return;
+    }
+    mp_limb_t y = mpz_getlimbn(r_prime, 0);
+    mpz_set_ui(g, gcd_limb(mpz_fdiv_ui(r, y), y));
+}
+
 // Computes the greatest common divisor between a and b,
 // and stores the value in g.
 //
 // g: store computed result here
 // a and b: find gcd of these two numbers
 void gcd(mpz_t g, mpz_t a, mpz_t b) {
-    // Create copies of a and b to preserve their value
-    mpz_t temp, a_copy, b_copy;
-    mpz_inits(temp, a_copy, b_copy, NULL);
-    mpz_set(a_copy, a);
-    mpz_set(b_copy, b);
-    // While b_copy does not equal 0
-    // temp preserves the original value of b_copy
-    // a_copy = b_copy
-    // b_copy = a_copy % b_copy
-    while (mpz_cmp_ui(b_copy, 0) != 0) {
-        mpz_set(temp, b_copy);
-        mpz_mod(b_copy, a_copy, b_copy);
-        mpz_set(a_copy, temp);
-    }
-    // Set g to computed gcd (a_copy)
-    mpz_set(g, a_copy);
-    mpz_clears(temp, a_copy, b_copy, NULL);
+    NumCtx c;
+    num_ctx_init(&c);
+    gcd_ctx(&c, g, a, b);
+    num_ctx_clear(&c);
 }
 
 // Computes the inverse o of a modulo n, and if no inverse is
 // found, o is set to 0.
 //
+// This is Lehmer's extended Euclid: the quotients of many Euclid steps
+// are found from the leading bits of the remainders alone, and their
+// product is applied to the full numbers in one pass.
+//
+// c: scratch context
 // o: modular inverse stored here
 // a: base value
 // n: modulo value
-void mod_inverse(mpz_t o, mpz_t a, mpz_t n) {
-    // Initialize necessary mpz_t variables
-    mpz_t r, r_prime, t, t_prime, q, temp;
-    mpz_inits(r, r_prime, t, t_prime, q, temp, NULL);
+void mod_inverse_ctx(NumCtx *c, mpz_t o, mpz_t a, mpz_t n) {
+    mpz_ptr r = c->t[T_INV], r_prime = c->t[T_INV + 1];
+    mpz_ptr t = c->t[T_INV + 2], t_prime = c->t[T_INV + 3];
+    mpz_ptr q = c->t[T_INV + 4], u = c->t[T_INV + 5], v = c->t[T_INV + 6];
 
-    // r = n, r_prime = a, t = 0, t_prime = 1
+    // r = n, r_prime = a mod n, t = 0, t_prime = 1
+    mpz_mod(r_prime, a, n);
     mpz_set(r, n);
-    mpz_set(r_prime, a);
     mpz_set_ui(t, 0);
     mpz_set_ui(t_prime, 1);
 
-    // While r_prime does not equal 0
-    while (mpz_cmp_ui(r_prime, 0) != 0) {
-        // q = floor divide r / r_prime
-        mpz_fdiv_q(q, r, r_prime);
-
-        // temp is used for preserving the original value of r.
-        // r = r_prime
-        // r_prime = r - q * r_prime
-        mpz_set(temp, r);
-        mpz_set(r, r_prime);
-        mpz_submul(temp, q, r_prime);
-        mpz_set(r_prime, temp);
+    // While r_prime needs more than a limb, step on the leading bits
+    int64_t m[4];
+    while (mpz_size(r_prime) > 1) {
+        if (lehmer_matrix(m, r, r_prime)) {
+            // Apply the steps to t and t_prime as well
+            lehmer_apply(m, r, r_prime, u, v);
+            lehmer_apply(m, t, t_prime, u, v);
+        } else {
+            // No quotient was certain, so take one full Euclid step
+            mpz_fdiv_qr(q, r, r, r_prime);
+            mpz_swap(r, r_prime);
+            mpz_submul(t, q, t_prime);
+            mpz_swap(t, t_prime);
+        }
+    }
 
-        // Do the same operations for t and t_prime
-        mpz_set(temp, t);
-        mpz_set(t, t_prime);
-        mpz_submul(temp, q, t_prime);
-        mpz_set(t_prime, temp);
+    // Finish with plain Euclid steps on the short remainders
+    while (mpz_sgn(r_prime) != 0) {
+        mpz_fdiv_qr(q, r, r, r_prime);
+        mpz_swap(r, r_prime);
+        mpz_submul(t, q, t_prime);
+        mpz_swap(t, t_prime);
     }
 
     // If r > 1, there is no inverse
     if (mpz_cmp_ui(r, 1) > 0) {
         mpz_set_ui(o, 0);
-        mpz_clears(r, r_prime, t, t_prime, q, temp, NULL);
         return;
     }
     // If t < 0, add n to t
-    if (mpz_cmp_ui(t, 0) < 0) {
+    if (mpz_sgn(t) < 0) {
         mpz_add(t, t, n);
     }
     // Computed modular inverse stored in o
     mpz_set(o, t);
-    mpz_clears(r, r_prime, t, t_prime, q, temp, NULL);
+}
+
+// Computes the inverse o of a modulo n, and if no inverse is
+// found, o is set to 0.
+//
+// o: modular inverse stored here
+// a: base value
+// n: modulo value
+void mod_inverse(mpz_t o, mpz_t a, mpz_t n) {
+    NumCtx c;
+    num_ctx_init(&c);
+    mod_inverse_ctx(&c, o, a, n);
+    num_ctx_clear(&c);
+}
+
+// Exponents with at most this many bits are not worth converting into
+// Montgomery form for, such as small public exponents.
+#define MONT_MIN_BITS 16
+
+// Sets up the Montgomery form of an odd modulus n > 1 in 2 * size(n)
+// limbs that the caller provides.
+//
+// m: Montgomery form that is set up
+// n: odd modulus
+// limbs: storage for the form
+// r2: scratch number
+static void mont_setup(Mont *m, mpz_t n, mp_limb_t *limbs, mpz_t r2) {
+    m->size = mpz_size(n);
+    m->n = limbs;
+    m->r2 = m->n + m->size;
+    mpn_copyi(m->n, mpz_limbs_read(n), m->size);
+
+    // Newton's iteration doubles the correct low bits of 1/n each step,
+    // starting from n itself, which is its own inverse mod 8
+    mp_limb_t inv = m->n[0];
+    for (uint32_t i = 0; i < 6; i += 1) {
+        inv *= 2 - m->n[0] * inv;
+    }
+    m->ninv = -inv;
+
+    // R^2 mod n turns numbers into Montgomery form with one product
+    mpz_set_ui(r2, 0);
+    mpz_setbit(r2, 2 * GMP_NUMB_BITS * m->size);
+    mpz_mod(r2, r2, n);
+    mpn_zero(m->r2, m->size);
+    mpn_copyi(m->r2, mpz_limbs_read(r2), mpz_size(r2));
+}
+
+// Sets up the Montgomery form of an odd modulus n > 1.
+//
+// m: Montgomery form that is set up
+// n: odd modulus
+void mont_init(Mont *m, mpz_t n) {
+    mpz_t r2;
+    mpz_init(r2);
+    mont_setup(m, n, (mp_limb_t *) num_alloc(2 * mpz_size(n), sizeof(mp_limb_t)), r2);
+    mpz_clear(r2);
+}
+
+// Frees the limbs of a Montgomery form.
+//
+// m: Montgomery form to clear
+void mont_clear(Mont *m) {
+    free(m->n);
+    m->n = m->r2 = NULL;
+}
+
+// Montgomery reduction: sets r to t / R mod n, where t has 2 * size
+// limbs and is less than n * R. t is overwritten.
+//
+// m: Montgomery form of n
+// r: size limbs of result
+// t: 2 * size limbs to reduce
+static void mont_redc(Mont *m, mp_limb_t *r, mp_limb_t *t) {
+    mp_size_t s = m->size;
+    // Each step clears the lowest limb of t. Its carry is kept in the
+    // cleared limb and added in at the end.
+    for (mp_size_t i = 0; i < s; i += 1) {
+        t[i] = mpn_addmul_1(t + i, m->n, s, t[i] * m->ninv);
+    }
+    if (mpn_add_n(r, t + s, t, s) || mpn_cmp(r, m->n, s) >= 0) {
+        mpn_sub_n(r, r, m->n, s);
+    }
+}
+
+// Sets r to a * b / R mod n. r may be a or b.
+//
+// m: Montgomery form of n
+// r: size limbs of result
+// a and b: size limbs of the factors
+// t: 2 * size limbs of scratch
+static void mont_mul(Mont *m, mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b, mp_limb_t *t) {
+    if (a == b) {
+        mpn_sqr(t, a, m->size);
+    } else {
+        mpn_mul_n(t, a, b, m->size);
+    }
+    mont_redc(m, r, t);
+}
+
+// Returns the window size for a sliding window exponentiation with an
+// exponent of bits bits, which trades the odd powers that have to be
+// computed up front against the multiplications they save.
+//
+// bits: length of the exponent
+static uint32_t window_bits(uint64_t bits) {
+    return bits > 671 ? 6 : bits > 239 ? 5 : bits > 79 ? 4 : bits > 23 ? 3 : bits > 6 ? 2 : 1;
+}
+
+// Computes a raised to the d power modulo n and stores the result in o,
+// with the Montgomery form of n. Scans d from the top bit down in
+// windows of up to window_bits() bits that start and end with a 1, so
+// that each window costs one multiplication by a precomputed odd power
+// of a. o may be a or d.
+//
+// c: scratch context
+// m: Montgomery form of the modulus n
+// o: store computed result here
+// a: base value
+// d: raise base to this power
+void mont_pow_ctx(NumCtx *c, Mont *m, mpz_t o, mpz_t a, mpz_t d) {
+    mp_size_t s = m->size;
+    if (mpz_sgn(d) <= 0) {
+        mpz_set_ui(o, 1);
+        return;
+    }
+    uint64_t bits = mpz_sizeinbase(d, 2);
+    uint32_t w = window_bits(bits);
+    uint32_t powers = 1 << (w - 1);
+
+    // The scratch limbs hold the odd powers, the accumulator, and scratch
+    mp_limb_t *table = ctx_limbs(c, (powers + 4) * s);
+    mp_limb_t *acc = table + powers * s;
+    mp_limb_t *t = acc + s;
+    mp_limb_t *sq = t + 2 * s;
+
+    // a^1 in Montgomery form, then a^2, and then a^3, a^5, and so on
+    mpz_ptr base = c->t[T_BASE];
+    mpz_t n;
+    mpz_roinit_n(n, m->n, s);
+    mpz_mod(base, a, n);
+    mpn_zero(acc, s);
+    mpn_copyi(acc, mpz_limbs_read(base), mpz_size(base));
+    mont_mul(m, table, acc, m->r2, t);
+    mont_mul(m, sq, table, table, t);
+    for (uint32_t i = 1; i < powers; i += 1) {
+        mont_mul(m, table + i * s, table + (i - 1) * s, sq, t);
+    }
+
+    bool first = true;
+    for (int64_t i = bits - 1; i >= 0;) {
+        if (!mpz_tstbit(d, i)) {
+            mont_mul(m, acc, acc, acc, t);
+            i -= 1;
+            continue;
+        }
+        // The longest window of at most w bits from i that ends in a 1
+        int64_t low = i - w + 1 > 0 ? i - w + 1 : 0;
+        while (!mpz_tstbit(d, low)) {
+            low += 1;
+        }
+        uint32_t value = 0;
+        for (int64_t j = i; j >= low; j -= 1) {
+            value = 2 * value + mpz_tstbit(d, j);
+        }
+        if (first) {
+            mpn_copyi(acc, table + (value >> 1) * s, s);
+            first = false;
+        } else {
+            for (int64_t j = i; j >= low; j -= 1) {
+                mont_mul(m, acc, acc, acc, t);
+            }
+            mont_mul(m, acc, acc, table + (value >> 1) * s, t);
+        }
+        i = low - 1;
+    }
+
+    // Out of Montgomery form: one reduction of acc by itself
+    mpn_copyi(t, acc, s);
+    mpn_zero(t + s, s);
+    mont_redc(m, acc, t);
+    mpn_copyi(mpz_limbs_write(o, s), acc, s);
+    mpz_limbs_finish(o, s);
+}
+
+// Computes a raised to the d power modulo n and stores the result in o,
+// with the Montgomery form of n. o may be a or d.
+//
+// m: Montgomery form of the modulus n
+// o: store computed result here
+// a: base value
+// d: raise base to this power
+void mont_pow(Mont *m, mpz_t o, mpz_t a, mpz_t d) {
+    NumCtx c;
+    num_ctx_init(&c);
+    mont_pow_ctx(&c, m, o, a, d);
+    num_ctx_clear(&c);
+}
+
+// Computes a raised to a word-sized power e modulo n and stores the
+// result in o, with the Montgomery form of n. Square-and-multiply from
+// the top bit of e needs no table of powers, so a short exponent costs
+// one product per bit after the first and one per further set bit:
+// 17 for e = 65537. o may be a.
+//
+// c: scratch context
+// m: Montgomery form of the modulus n
+// o: store computed result here
+// a: base value
+// e: raise base to this power
+void mont_pow_ui_ctx(NumCtx *c, Mont *m, mpz_t o, mpz_t a, uint64_t e) {
+    mp_size_t s = m->size;
+    if (e == 0) {
+        mpz_set_ui(o, 1);
+        return;
+    }
+    mp_limb_t *base = ctx_limbs(c, 4 * s);
+    mp_limb_t *acc = base + s;
+    mp_limb_t *t = acc + s;
+
+    // a in Montgomery form
+    mpz_ptr b = c->t[T_BASE];
+    mpz_t n;
+    mpz_roinit_n(n, m->n, s);
+    mpz_mod(b, a, n);
+    mpn_zero(acc, s);
+    mpn_copyi(acc, mpz_limbs_read(b), mpz_size(b));
+    mont_mul(m, base, acc, m->r2, t);
+    mpn_copyi(acc, base, s);
+
+    uint32_t bits = 0;
+    for (uint64_t v = e; v; v >>= 1) {
+        bits += 1;
+    }
+    for (int32_t i = bits - 2; i >= 0; i -= 1) {
+        mont_mul(m, acc, acc, acc, t);
+        if ((e >> i) & 1) {
+            mont_mul(m, acc, acc, base, t);
+        }
+    }
+
+    // Out of Montgomery form: one reduction of acc by itself
+    mpn_copyi(t, acc, s);
+    mpn_zero(t + s, s);
+    mont_redc(m, acc, t);
+    mpn_copyi(mpz_limbs_write(o, s), acc, s);
+    mpz_limbs_finish(o, s);
+}
+
+// Computes a raised to a word-sized power e modulo n and stores the
+// result in o, with the Montgomery form of n. o may be a.
+//
+// m: Montgomery form of the modulus n
+// o: store computed result here
+// a: base value
+// e: raise base to this power
+void mont_pow_ui(Mont *m, mpz_t o, mpz_t a, uint64_t e) {
+    NumCtx c;
+    num_ctx_init(&c);
+    mont_pow_ui_ctx(&c, m, o, a, e);
+    num_ctx_clear(&c);
+}
+
+// Returns the Montgomery form of the odd modulus n > 1 that c keeps,
+// setting it up again only if it was last set up for another modulus.
+//
+// c: scratch context
+// n: odd modulus
+static Mont *ctx_mont(NumCtx *c, mpz_t n) {
+    if (c->mont.size == 0 || mpz_cmp(c->modulus, n) != 0) {
+        size_t count = 2 * mpz_size(n);
+        if (count > c->mont_size) {
+            free(c->mont_limbs);
+            c->mont_limbs = (mp_limb_t *) num_alloc(count, sizeof(mp_limb_t));
+            c->mont_size = count;
+        }
+        mont_setup(&c->mont, n, c->mont_limbs, c->t[T_BASE]);
+        mpz_set(c->modulus, n);
+    }
+    return &c->mont;
 }
 
 // Performs modular exponentiation by computing the base a raised to
-// d power modulo n and stores the result in o.
+// d power modulo n and stores the result in o. Odd moduli, which are
+// all that RSA and Miller-Rabin use, go through mont_pow_ctx() with
+// the Montgomery form that c keeps for n; short exponents and even
+// moduli use square-and-multiply.
 //
+// c: scratch context
 // o: store computed result here
 // a: base value
 // d: raise base to this power
 // n: modulo value
-void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
-    // v = 1, p = a, d_copy = d
-    mpz_t v, p, d_copy, temp;
-    mpz_inits(v, p, temp, d_copy, NULL);
+void pow_mod_ctx(NumCtx *c, mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    if (mpz_odd_p(n) && mpz_cmp_ui(n, 1) > 0 && mpz_sizeinbase(d, 2) > MONT_MIN_BITS) {
+        mont_pow_ctx(c, ctx_mont(c, n), o, a, d);
+        return;
+    }
+
+    // v = 1, p = a mod n
+    mpz_ptr v = c->t[T_POW], p = c->t[T_POW + 1];
     mpz_set_ui(v, 1);
-    mpz_set(p, a);
-    mpz_set(d_copy, d);
-
-    // While d_copy > 0
-    while (mpz_cmp_ui(d_copy, 0) > 0) {
-        // If d_copy is odd
-        if (mpz_odd_p(d_copy) != 0) {
-            // v = (v * p) % n
+    mpz_mod(p, a, n);
+
+    // Square-and-multiply from the top bit of d down
+    for (int64_t i = mpz_sgn(d) > 0 ? (int64_t) mpz_sizeinbase(d, 2) - 1 : -1; i >= 0; i -= 1) {
+        // v = (v * v) % n
+        mpz_mul(v, v, v);
+        mpz_mod(v, v, n);
+        // If bit i of d is set, v = (v * p) % n
+        if (mpz_tstbit(d, i)) {
             mpz_mul(v, v, p);
             mpz_mod(v, v, n);
         }
-        // p = (p * p) % n
-        mpz_mul(p, p, p);
-        mpz_mod(p, p, n);
-        // d_copy = floor divide d_copy / 2
-        mpz_fdiv_q_ui(d_copy, d_copy, 2);
     }
     // Set o to computed power mod (v)
     mpz_set(o, v);
-    mpz_clears(v, p, temp, d_copy, NULL);
 }
 
-// Uses the Miller-Rabin primality test to check whether or not n is prime
-// using iters number of iterations.
+// Performs modular exponentiation by computing the base a raised to
+// d power modulo n and stores the result in o.
 //
+// o: store computed result here
+// a: base value
+// d: raise base to this power
+// n: modulo value
+void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n) {
+    NumCtx c;
+    num_ctx_init(&c);
+    pow_mod_ctx(&c, o, a, d, n);
+    num_ctx_clear(&c);
+}
+
+// Numbers below this are tested by trial division.
+#define TRIAL_LIMIT 1024
+
+// Returns whether n, an odd number greater than 3, is a strong probable
+// prime to base a: with n - 1 = 2^s * r and r odd, either a^r = 1 or
+// a^(2^j * r) = n - 1 for some j < s, modulo n.
+//
+// c: scratch context
+// m: Montgomery form of n
 // n: number that is checked
-// iters: number of iterations
-bool is_prime(mpz_t n, uint64_t iters) {
-    // If number n is 2 or 3, it is prime
-    if (mpz_cmp_ui(n, 2) == 0 || mpz_cmp_ui(n, 3) == 0) {
+// a: base
+// r: odd part of n - 1
+// s: power of 2 in n - 1
+// n_minus1: n - 1
+// y: scratch number
+static bool strong_probable_prime(
+    NumCtx *c, Mont *m, mpz_t n, mpz_t a, mpz_t r, uint64_t s, mpz_t n_minus1, mpz_t y) {
+    mont_pow_ctx(c, m, y, a, r);
+    if (mpz_cmp_ui(y, 1) == 0 || mpz_cmp(y, n_minus1) == 0) {
         return true;
     }
-    // If number n is less than or equal to 1 or is even, it is not prime
-    if (mpz_cmp_ui(n, 1) <= 0 || (mpz_even_p(n) != 0)) {
-        return false;
+    for (uint64_t j = 1; j < s; j += 1) {
+        // y = y^2 mod n. Once y is 1 it stays 1 and never reaches n - 1
+        mpz_mul(y, y, y);
+        mpz_mod(y, y, n);
+        if (mpz_cmp(y, n_minus1) == 0) {
+            return true;
+        }
+        if (mpz_cmp_ui(y, 1) == 0) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Sets r to a - b mod n, where a and b are less than n.
+//
+// m: Montgomery form of n
+// r: size limbs of result
+// a and b: size limbs of the operands
+static void mont_sub(Mont *m, mp_limb_t *r, const mp_limb_t *a, const mp_limb_t *b) {
+    if (mpn_sub_n(r, a, b, m->size)) {
+        mpn_add_n(r, r, m->n, m->size);
+    }
+}
+
+// Sets r to the Montgomery form of v, where v is less than n.
+//
+// m: Montgomery form of n
+// r: size limbs of result
+// v: value to convert
+// t: 2 * size limbs of scratch
+static void mont_set_ui(Mont *m, mp_limb_t *r, mp_limb_t v, mp_limb_t *t) {
+    mpn_zero(r, m->size);
+    r[0] = v;
+    mont_mul(m, r, r, m->r2, t);
+}
+
+// Returns whether n, an odd number greater than TRIAL_LIMIT that is not
+// a perfect square, is an almost extra strong Lucas probable prime. P is
+// the first of 3, 4, 5, ... with Jacobi symbol (P^2 - 4 / n) = -1, Q is
+// 1, and with n + 1 = 2^s * d and d odd, n passes if V_d = 2 or -2, or
+// V_(2^j * d) = 0 for some j < s - 1, modulo n. Only the sequence V is
+// needed, whose terms V_2k = V_k^2 - 2 and V_2k+1 = V_k * V_k+1 - P take
+// two Montgomery products for each bit of d.
+//
+// c: scratch context
+// m: Montgomery form of n
+// n: number that is checked
+static bool lucas_probable_prime(NumCtx *c, Mont *m, mpz_t n) {
+    uint64_t P = 3;
+    while (true) {
+        int jacobi = mpz_si_kronecker(P * P - 4, n);
+        if (jacobi == -1) {
+            break;
+        }
+        // P^2 - 4 shares a factor with n, and n is larger
+        if (jacobi == 0) {
+            return false;
+        }
+        P += 1;
+    }
+
+    mpz_ptr d = c->t[T_LUCAS];
+    mpz_add_ui(d, n, 1);
+    uint64_t s = mpz_scan1(d, 0);
+    mpz_tdiv_q_2exp(d, d, s);
+
+    mp_size_t size = m->size;
+    mp_limb_t *v = ctx_limbs(c, 7 * size);
+    mp_limb_t *w = v + size;
+    mp_limb_t *p = w + size;
+    mp_limb_t *two = p + size;
+    mp_limb_t *minus2 = two + size;
+    mp_limb_t *t = minus2 + size;
+    mont_set_ui(m, p, P, t);
+    mont_set_ui(m, two, 2, t);
+    mpn_sub_n(minus2, m->n, two, size);
+
+    // (v, w) = (V_k, V_k+1) as k runs through the prefixes of d from its
+    // top bit down, starting from (V_1, V_2) = (P, P^2 - 2)
+    mpn_copyi(v, p, size);
+    mont_mul(m, w, p, p, t);
+    mont_sub(m, w, w, two);
+    for (int64_t i = (int64_t) mpz_sizeinbase(d, 2) - 2; i >= 0; i -= 1) {
+        if (mpz_tstbit(d, i)) {
+            mont_mul(m, v, v, w, t);
+            mont_sub(m, v, v, p);
+            mont_mul(m, w, w, w, t);
+            mont_sub(m, w, w, two);
+        } else {
+            mont_mul(m, w, v, w, t);
+            mont_sub(m, w, w, p);
+            mont_mul(m, v, v, v, t);
+            mont_sub(m, v, v, two);
+        }
     }
 
-    // Initialize mpz_t variables
-    mpz_t r, s, temp, y, j, a, n_minus1, n_minus3, s_minus1;
-    mpz_inits(r, s, temp, y, j, a, n_minus1, n_minus3, s_minus1, NULL);
+    bool prime = mpn_cmp(v, two, size) == 0 || mpn_cmp(v, minus2, size) == 0;
+    for (uint64_t j = 0; j + 1 < s && !prime; j += 1) {
+        prime = mpn_zero_p(v, size);
+        mont_mul(m, v, v, v, t);
+        mont_sub(m, v, v, two);
+    }
+    return prime;
+}
+
+// Checks whether or not n is prime. Small numbers are checked by trial
+// division. Larger ones first have to pass the Baillie-PSW test, a
+// strong probable prime test to base 2 followed by a Lucas test, which
+// no composite number is known to pass, and then iters rounds of
+// Miller-Rabin with random bases drawn from rs. Threads that test
+// numbers at the same time each need a random state of their own.
+//
+// c: scratch context
+// n: number that is checked
+// iters: number of Miller-Rabin iterations after Baillie-PSW
+// rs: random state the bases are drawn from
+bool is_prime_ctx(NumCtx *c, mpz_t n, uint64_t iters, gmp_randstate_t rs) {
+    if (mpz_cmp_ui(n, TRIAL_LIMIT) < 0) {
+        uint64_t v = mpz_sgn(n) > 0 ? mpz_get_ui(n) : 0;
+        if (v < 4) {
+            return v >= 2;
+        }
+        for (uint64_t i = 2; i * i <= v; i += 1) {
+            if (v % i == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (mpz_even_p(n)) {
+        return false;
+    }
 
-    // Calculate n - 1 and n - 3 for later use
+    // Writes n - 1 = 2^s*r such that r is odd
+    mpz_ptr r = c->t[T_PRIME], y = c->t[T_PRIME + 1], a = c->t[T_PRIME + 2];
+    mpz_ptr n_minus1 = c->t[T_PRIME + 3], n_minus3 = c->t[T_PRIME + 4];
     mpz_sub_ui(n_minus1, n, 1);
     mpz_sub_ui(n_minus3, n, 3);
+    uint64_t s = mpz_scan1(n_minus1, 0);
+    mpz_tdiv_q_2exp(r, n_minus1, s);
 
-    // r = n - 1, s = 0
-    mpz_set(r, n_minus1);
-    mpz_set_ui(s, 0);
+    // Every base is raised to r with the same Montgomery form of n
+    Mont *m = ctx_mont(c, n);
+    mpz_set_ui(a, 2);
+    bool prime = strong_probable_prime(c, m, n, a, r, s, n_minus1, y) && !mpz_perfect_square_p(n)
+                 && lucas_probable_prime(c, m, n);
+    for (uint64_t i = 0; i < iters && prime; i += 1) {
+        // A random value a between 2 and n-2
+        mpz_urandomm(a, rs, n_minus3);
+        mpz_add_ui(a, a, 2);
+        prime = strong_probable_prime(c, m, n, a, r, s, n_minus1, y);
+    }
+    return prime;
+}
 
-    // Writes n - 1 = 2^s*r such that r is odd
-    while (mpz_even_p(r) != 0) {
-        // r = floor divide r / 2
-        mpz_fdiv_q_ui(r, r, 2);
-        // s = s + 1
-        mpz_add_ui(s, s, 1);
+// Checks whether or not n is prime with the Baillie-PSW test and then
+// iters rounds of Miller-Rabin, with bases from the global random state.
+//
+// n: number that is checked
+// iters: number of Miller-Rabin iterations
+bool is_prime(mpz_t n, uint64_t iters) {
+    NumCtx c;
+    num_ctx_init(&c);
+    bool prime = is_prime_ctx(&c, n, iters, state);
+    num_ctx_clear(&c);
+    return prime;
+}
+
+// Search for one prime: the odd numbers start, start + 2, ... of a window
+// that are not divisible by a small prime are tested in order, and the
+// first of them that passes is_prime_ctx() is the prime.
+typedef struct {
+    mpz_ptr prime; // Where the prime is stored.
+    uint64_t bits; // Length of the prime in bits.
+    mpz_t start; // Random odd number the window starts at.
+    uint32_t *offsets; // Offset from start of each candidate left by the sieve.
+    uint32_t count; // Number of candidates.
+    uint64_t seed; // Seeds the Miller-Rabin bases of each candidate.
+    atomic_uint_fast32_t next; // Next candidate to hand out.
+    atomic_uint_fast32_t found; // Lowest candidate found to be prime, or count.
+} PrimeSearch;
+
+// Prime searches shared by the threads of a pool.
+typedef struct {
+    PrimeSearch *searches;
+    uint32_t count;
+    uint64_t iters;
+} PrimeJob;
+
+static uint32_t small_primes[SIEVE_PRIMES]; // Odd primes below SIEVE_LIMIT.
+static uint32_t small_count;
+
+// Fills small_primes with the odd primes below SIEVE_LIMIT, once.
+static void small_primes_init(void) {
+    if (small_count) {
+        return;
     }
+    bool *composite = (bool *) num_alloc(SIEVE_LIMIT, sizeof(bool));
+    for (uint32_t i = 3; i < SIEVE_LIMIT; i += 2) {
+        if (!composite[i]) {
+            small_primes[small_count++] = i;
+            for (uint32_t j = i * i; j < SIEVE_LIMIT; j += 2 * i) {
+                composite[j] = true;
+            }
+        }
+    }
+    free(composite);
+}
 
-    for (uint64_t i = 1; i <= iters; i += 1) {
-        // Generate a random value a between 2 and n-2, store in a,
-        // and calculate the pow mod of a raised to power r modulo n.
-        mpz_urandomm(a, state, n_minus3);
-        mpz_add_ui(a, a, 2);
-        pow_mod(y, a, r, n);
-
-        // If y != 1 and y != (n - 1)
-        if (mpz_cmp_ui(y, 1) != 0 && mpz_cmp(y, n_minus1) != 0) {
-            mpz_set_ui(j, 1);
-            // While j < s and y != (n - 1)
-            while (mpz_cmp(j, s) < 0 && mpz_cmp(y, n_minus1) != 0) {
-                mpz_set_ui(temp, 2);
-                // Calculate pow mod of y raised to power 2 modulo n
-                pow_mod(y, y, temp, n);
-                // If y == 1, the number is not prime
-                if (mpz_cmp_ui(y, 1) == 0) {
-                    mpz_clears(r, s, temp, y, j, a, n_minus1, n_minus3, NULL);
-                    return false;
-                }
-                mpz_add_ui(j, j, 1);
+// Draws a random odd start of bits bits for s from state and sieves the
+// window after it: each candidate start + 2j that no small prime divides
+// and that is still bits long is kept, in order.
+//
+// s: the search, with bits and offsets set
+static void prime_search_draw(PrimeSearch *s) {
+    mpz_urandomb(s->start, state, s->bits - 1);
+    mpz_setbit(s->start, s->bits - 1);
+    mpz_setbit(s->start, 0);
+    s->seed = gmp_urandomb_ui(state, 32);
+
+    // Stop the window at 2^bits so that every candidate is bits long
+    uint32_t span = SIEVE_SPAN;
+    mpz_t top;
+    mpz_init(top);
+    mpz_setbit(top, s->bits);
+    mpz_sub(top, top, s->start);
+    if (mpz_cmp_ui(top, 2 * SIEVE_SPAN) < 0) {
+        span = (mpz_get_ui(top) + 1) / 2;
+    }
+    mpz_clear(top);
+
+    // Cross out start + 2j for every j where p divides it. Since 2 has the
+    // inverse (p + 1) / 2 mod p, the first such j is (p - r) * (p + 1) / 2
+    // mod p, where r = start mod p. A start below SIEVE_LIMIT may be a small
+    // prime itself, which is not crossed out.
+    bool small = mpz_cmp_ui(s->start, SIEVE_LIMIT) < 0;
+    uint64_t low = small ? mpz_get_ui(s->start) : 0;
+    uint8_t *composite = (uint8_t *) num_alloc(span, sizeof(uint8_t));
+    for (uint32_t i = 0; i < small_count; i += 1) {
+        uint64_t p = small_primes[i];
+        uint64_t r = mpz_fdiv_ui(s->start, p);
+        uint64_t j = (p - r) % p * ((p + 1) / 2) % p;
+        if (small && low + 2 * j == p) {
+            j += p;
+        }
+        for (; j < span; j += p) {
+            composite[j] = 1;
+        }
+    }
+    s->count = 0;
+    for (uint32_t j = 0; j < span; j += 1) {
+        if (!composite[j]) {
+            s->offsets[s->count++] = 2 * j;
+        }
+    }
+    free(composite);
+    atomic_init(&s->next, 0);
+    atomic_init(&s->found, s->count);
+}
+
+// Tests candidates of every search of a PrimeJob until each search has
+// found its prime or run out. Candidates are handed out in order, and the
+// threads take turns between the searches, so the searches run at the same
+// time. A candidate after one already found to be prime is skipped. Each
+// candidate's bases come from its own seed, so the result is the same for
+// any number of threads.
+//
+// arg: the PrimeJob
+// id: the thread's id
+// threads: number of threads running the task
+static void prime_search_run(void *arg, uint32_t id, uint32_t threads) {
+    (void) threads;
+    PrimeJob *job = (PrimeJob *) arg;
+    mpz_t x;
+    mpz_init(x);
+    gmp_randstate_t rs;
+    gmp_randinit_mt(rs);
+    NumCtx c;
+    num_ctx_init(&c);
+    for (uint32_t turn = id;; turn += 1) {
+        // Take the next candidate of the first search, from this turn's,
+        // that has one left
+        PrimeSearch *s = NULL;
+        uint32_t i = 0;
+        for (uint32_t k = 0; k < job->count && !s; k += 1) {
+            PrimeSearch *t = &job->searches[(turn + k) % job->count];
+            if (atomic_load(&t->next) >= atomic_load(&t->found)) {
+                continue;
             }
-            // If y != (n - 1), the number is not prime
-            if (mpz_cmp(y, n_minus1) != 0) {
-                mpz_clears(r, s, temp, y, j, a, n_minus1, n_minus3, NULL);
-                return false;
+            i = atomic_fetch_add(&t->next, 1);
+            if (i < atomic_load(&t->found)) {
+                s = t;
+            }
+        }
+        if (!s) {
+            break;
+        }
+        mpz_add_ui(x, s->start, s->offsets[i]);
+        gmp_randseed_ui(rs, s->seed + i);
+        if (is_prime_ctx(&c, x, job->iters, rs)) {
+            // Keep the lowest candidate found to be prime
+            uint_fast32_t found = atomic_load(&s->found);
+            while (i < found && !atomic_compare_exchange_weak(&s->found, &found, i)) {
             }
         }
     }
-    mpz_clears(r, s, temp, y, j, a, n_minus1, n_minus3, NULL);
-    // Made it through the for loop, so the number is prime
-    return true;
+    num_ctx_clear(&c);
+    gmp_randclear(rs);
+    mpz_clear(x);
+}
+
+// Finds a prime for each search, running the searches at the same time on
+// the threads of pool, or on the caller if pool is NULL. A search whose
+// window has no prime draws a new window.
+//
+// searches: the searches, with prime and bits set
+// count: number of searches
+// iters: Miller-Rabin iterations for each candidate
+// pool: threads that test the candidates, or NULL
+static void prime_search(PrimeSearch *searches, uint32_t count, uint64_t iters, Pool *pool) {
+    small_primes_init();
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_init(searches[i].start);
+        searches[i].offsets = (uint32_t *) num_alloc(SIEVE_SPAN, sizeof(uint32_t));
+        prime_search_draw(&searches[i]);
+    }
+    PrimeJob job = { searches, count, iters };
+    while (true) {
+        if (pool) {
+            pool_run(pool, prime_search_run, &job);
+        } else {
+            prime_search_run(&job, 0, 1);
+        }
+        // A search that found its prime hands out no more candidates
+        bool done = true;
+        for (uint32_t i = 0; i < count; i += 1) {
+            PrimeSearch *s = &searches[i];
+            uint32_t found = atomic_load(&s->found);
+            if (found < s->count) {
+                mpz_add_ui(s->prime, s->start, s->offsets[found]);
+            } else {
+                prime_search_draw(s);
+                done = false;
+            }
+        }
+        if (done) {
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < count; i += 1) {
+        mpz_clear(searches[i].start);
+        free(searches[i].offsets);
+    }
 }
 
 // Creates a random prime number p that is bits number
 // of bits long.
 //
 // p: random prime number that is generated
-// bits: length of p in bits
-// iters: used in is_prime() call
+// bits: length of p in bits, at least 2
+// iters: number of Miller-Rabin iterations for each candidate
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters) {
-    // Offset used for range of bits
-    mpz_t offset, x;
-    mpz_inits(offset, x, NULL);
-    mpz_set_ui(x, 1);
-    mpz_mul_2exp(offset, x, bits - 1);
-    do {
-        // Generate a random number that is bits number of bits
-        mpz_urandomb(p, state, bits - 1);
-        mpz_add(p, p, offset);
-    } while (!is_prime(p, iters)); // Until that number is prime
-    mpz_clears(offset, x, NULL);
+    PrimeSearch s = { .prime = p, .bits = bits };
+    prime_search(&s, 1, iters, NULL);
+}
+
+// Creates random primes p and q that are p_bits and q_bits long. Both
+// are searched for at the same time by the threads of pool, and they
+// only depend on the random state, not on the number of threads.
+//
+// p and q: random prime numbers that are generated
+// p_bits and q_bits: lengths of p and q in bits, at least 2
+// iters: number of Miller-Rabin iterations for each candidate
+// pool: threads that test the candidates
+void make_primes(mpz_t p, uint64_t p_bits, mpz_t q, uint64_t q_bits, uint64_t iters, Pool *pool) {
+    PrimeSearch s[2] = { { .prime = p, .bits = p_bits }, { .prime = q, .bits = q_bits } };
+    prime_search(s, 2, iters, pool);
 }
@@ -5,12 +5,70 @@
 #include <stdio.h>
 #include <gmp.h>
 
+#include "pool.h"
+
+// Montgomery form of an odd modulus n, set up once so that any number
+// of exponentiations with the same modulus can share it.
+typedef struct {
+    mp_size_t size; // Limbs in n.
+    mp_limb_t *n; // The modulus.
+    mp_limb_t *r2; // R^2 mod n, where R = 2^(GMP_NUMB_BITS * size).
+    mp_limb_t ninv; // -1/n mod 2^GMP_NUMB_BITS.
+} Mont;
+
+#define NUM_TEMPS 7 // Scratch numbers in a NumCtx.
+#define PRIME_ITERS 4 // Default Miller-Rabin rounds that is_prime() runs after Baillie-PSW.
+
+// Scratch space for the numtheory functions. The _ctx variants take
+// their temporaries from one of these instead of allocating them, and
+// keep the Montgomery form of the last modulus they were given, so a
+// thread that keeps a context for its hot loop allocates nothing once
+// the numbers and limbs have grown to the size of its operands. A
+// context may only be used by one thread at a time.
+typedef struct {
+    mpz_t t[NUM_TEMPS]; // Scratch numbers.
+    mp_limb_t *limbs; // Scratch limbs.
+    size_t size; // Limbs at limbs.
+    Mont mont; // Montgomery form of modulus, when mont.size is not 0.
+    mpz_t modulus; // Modulus that mont was set up for.
+    mp_limb_t *mont_limbs; // Limbs of mont.
+    size_t mont_size; // Limbs at mont_limbs.
+} NumCtx;
+
+void *num_alloc(size_t count, size_t size);
+
+void num_ctx_init(NumCtx *c);
+
+void num_ctx_clear(NumCtx *c);
+
 void gcd(mpz_t g, mpz_t a, mpz_t b);
 
+void gcd_ctx(NumCtx *c, mpz_t g, mpz_t a, mpz_t b);
+
 void mod_inverse(mpz_t o, mpz_t a, mpz_t n);
 
+void mod_inverse_ctx(NumCtx *c, mpz_t o, mpz_t a, mpz_t n);
+
+void mont_init(Mont *m, mpz_t n);
+
+void mont_clear(Mont *m);
+
+void mont_pow(Mont *m, mpz_t o, mpz_t a, mpz_t d);
+
+void mont_pow_ctx(NumCtx *c, Mont *m, mpz_t o, mpz_t a, mpz_t d);
+
+void mont_pow_ui(Mont *m, mpz_t o, mpz_t a, uint64_t e);
+
+void mont_pow_ui_ctx(NumCtx *c, Mont *m, mpz_t o, mpz_t a, uint64_t e);
+
 void pow_mod(mpz_t o, mpz_t a, mpz_t d, mpz_t n);
 
+void pow_mod_ctx(NumCtx *c, mpz_t o, mpz_t a, mpz_t d, mpz_t n);
+
 bool is_prime(mpz_t n, uint64_t iters);
 
+bool is_prime_ctx(NumCtx *c, mpz_t n, uint64_t iters, gmp_randstate_t rs);
+
 void make_prime(mpz_t p, uint64_t bits, uint64_t iters);
+
+void make_primes(mpz_t p, uint64_t p_bits, mpz_t q, uint64_t q_bits, uint64_t iters, Pool *pool);
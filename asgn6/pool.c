@@ -0,0 +1,143 @@
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Argument of each worker thread.
+typedef struct {
+    Pool *pool;
+    uint32_t id;
+} Worker;
+
+struct Pool {
+    uint32_t threads; // Threads that run each task, counting the caller.
+    pthread_t *ids; // Thread of each worker.
+    Worker *workers; // Workers 1 up to threads - 1.
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // Signaled when a task is posted or the pool stops.
+    pthread_cond_t idle; // Signaled when the last worker finishes a task.
+    uint64_t posted; // Number of tasks posted so far.
+    uint32_t running; // Workers that have not finished the current task.
+    PoolTask task; // Task being run.
+    void *arg; // Argument of the task.
+    bool quit; // Set to stop the workers.
+};
+
+// Runs each task the pool is given as thread id until the pool is
+// deleted.
+//
+// arg: the thread's Worker
+static void *worker_run(void *arg) {
+    Worker *w = (Worker *) arg;
+    Pool *p = w->pool;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&p->lock);
+    while (true) {
+        while (p->posted == seen && !p->quit) {
+            pthread_cond_wait(&p->wake, &p->lock);
+        }
+        if (p->quit) {
+            break;
+        }
+        seen = p->posted;
+        pthread_mutex_unlock(&p->lock);
+        p->task(p->arg, w->id, p->threads);
+        pthread_mutex_lock(&p->lock);
+        if (--p->running == 0) {
+            pthread_cond_signal(&p->idle);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+// Creates a pool that runs tasks on up to threads threads: the caller
+// of pool_run() and workers that wait between tasks. If some workers
+// cannot be started, the pool runs with fewer threads. Returns NULL if
+// the pool could not be allocated.
+//
+// threads: number of threads, at least 1
+Pool *pool_create(uint32_t threads) {
+    Pool *p = (Pool *) calloc(1, sizeof(Pool));
+    threads = threads ? threads : 1;
+    if (p) {
+        p->ids = (pthread_t *) calloc(threads, sizeof(pthread_t));
+        p->workers = (Worker *) calloc(threads, sizeof(Worker));
+    }
+    if (!p || !p->ids || !p->workers) {
+        if (p) {
+            free(p->ids);
+            free(p->workers);
+        }
+        free(p);
+        return NULL;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->idle, NULL);
+    p->threads = 1;
+    for (uint32_t i = 1; i < threads; i += 1) {
+        p->workers[i] = (Worker) { .pool = p, .id = i };
+        if (pthread_create(&p->ids[i], NULL, worker_run, &p->workers[i]) != 0) {
+            break;
+        }
+        p->threads += 1;
+    }
+    return p;
+}
+
+// Stops the workers of a pool and frees it.
+//
+// p: pool to delete, set to NULL
+void pool_delete(Pool **p) {
+    if (*p) {
+        pthread_mutex_lock(&(*p)->lock);
+        (*p)->quit = true;
+        pthread_cond_broadcast(&(*p)->wake);
+        pthread_mutex_unlock(&(*p)->lock);
+        for (uint32_t i = 1; i < (*p)->threads; i += 1) {
+            pthread_join((*p)->ids[i], NULL);
+        }
+        pthread_mutex_destroy(&(*p)->lock);
+        pthread_cond_destroy(&(*p)->wake);
+        pthread_cond_destroy(&(*p)->idle);
+        free((*p)->ids);
+        free((*p)->workers);
+        free(*p);
+        *p = NULL;
+    }
+}
+
+// Returns the number of threads that run each task of a pool.
+//
+// p: pool
+uint32_t pool_threads(Pool *p) {
+    return p->threads;
+}
+
+// Runs task on every thread of a pool, with the caller as thread 0,
+// and returns once every thread has finished it.
+//
+// p: pool to run the task on
+// task: work each thread does
+// arg: passed to the task
+void pool_run(Pool *p, PoolTask task, void *arg) {
+    if (p->threads > 1) {
+        pthread_mutex_lock(&p->lock);
+        p->task = task;
+        p->arg = arg;
+        p->running = p->threads - 1;
+        p->posted += 1;
+        pthread_cond_broadcast(&p->wake);
+        pthread_mutex_unlock(&p->lock);
+    }
+    task(arg, 0, p->threads);
+    if (p->threads > 1) {
+        pthread_mutex_lock(&p->lock);
+        while (p->running > 0) {
+            pthread_cond_wait(&p->idle, &p->lock);
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+}
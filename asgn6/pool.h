@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef struct Pool Pool;
+
+// Work run on every thread of a pool: thread id of threads does its
+// share of whatever arg describes.
+typedef void (*PoolTask)(void *arg, uint32_t id, uint32_t threads);
+
+Pool *pool_create(uint32_t threads);
+
+void pool_delete(Pool **p);
+
+uint32_t pool_threads(Pool *p);
+
+void pool_run(Pool *p, PoolTask task, void *arg);
@@ -1,11 +1,21 @@
 #include "rsa.h"
 #include "randstate.h"
 #include "numtheory.h"
+#include "pool.h"
+#include "speck.h"
 
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <time.h>
+#include <string.h>
+
+#define CIPHER_MAGIC   "RSAC" // Starts binary ciphertext files.
+#define CIPHER_VERSION 1 // Version of the binary ciphertext format.
+#define CIPHER_HYBRID  2 // Version of the hybrid ciphertext format.
+#define CIPHER_HEADER  12 // Bytes in the header of a binary ciphertext file.
+#define CIPHER_BATCH   256 // Blocks read or written with each stdio call.
+#define SESSION_BYTES  (SPECK_KEY + 8) // SPECK key and nonce wrapped by RSA.
+#define STREAM_CHUNK   (1 << 20) // Bytes of a hybrid file body per stdio call.
 
 gmp_randstate_t state;
 
@@ -29,44 +39,55 @@ uint32_t log_base2(mpz_t n) {
 }
 
 // Makes an RSA public key by creating random large primes p and q,
-// their product n, and the public exponent e by finding a random
-// number that is coprime to n and also bits long.
+// their product n, and the public exponent e. With exponent 0, e is a
+// random number that is coprime to n and also bits long. Otherwise e
+// is exponent, such as the usual 65537, and p and q are made again
+// until it is coprime to the totient.
 //
 // p and q: two large prime numbers
 // n: product of p and q
 // e: public exponent
 // bits: length of random numbers generated
 // iters: number of Miller-Rabin iterations
-void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t bits, uint64_t iters) {
+// exponent: fixed odd public exponent, or 0 for a random one
+// pool: threads that search for p and q
+void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t bits, uint64_t iters,
+    uint64_t exponent, Pool *pool) {
     // Initialize mpz_t variables
     mpz_t rand, divisor, p_minus1, q_minus1, totient;
     mpz_inits(rand, divisor, p_minus1, q_minus1, totient, NULL);
+    NumCtx ctx;
+    num_ctx_init(&ctx);
 
-    // Set a pseudorandom seed. Generate a random number
-    // with random number of bit between (bits/4) and
-    // (3*bits/4) for p. Rest of bits go to q.
-    srandom(time(NULL));
-    uint64_t p_bits = (random() % (bits / 2) + 1) + bits / 4;
+    // Generate a random number of bits between (bits/4) and
+    // (3*bits/4) for p. Rest of bits go to q. It is drawn from
+    // the random state so that the key only depends on the seed.
+    uint64_t p_bits = (gmp_urandomm_ui(state, bits / 2) + 1) + bits / 4;
     uint64_t q_bits = bits - p_bits;
 
-    // Make p and q into large prime numbers. set n equal
-    // to p * q.
-    make_prime(p, p_bits + 1, iters);
-    make_prime(q, q_bits + 1, iters);
-    mpz_mul(n, p, q);
+    do {
+        // Make p and q into large prime numbers, searching for
+        // both at once.
+        make_primes(p, p_bits + 1, q, q_bits + 1, iters, pool);
 
-    // Set totient(n) = (p-1) * (q-1)
-    mpz_sub_ui(p_minus1, p, 1);
-    mpz_sub_ui(q_minus1, q, 1);
-    mpz_mul(totient, p_minus1, q_minus1);
+        // Set totient(n) = (p-1) * (q-1)
+        mpz_sub_ui(p_minus1, p, 1);
+        mpz_sub_ui(q_minus1, q, 1);
+        mpz_mul(totient, p_minus1, q_minus1);
+        mpz_set_ui(rand, exponent);
+        gcd_ctx(&ctx, divisor, totient, rand);
+    } while (exponent != 0 && mpz_cmp_ui(divisor, 1) != 0);
+    // set n equal to p * q.
+    mpz_mul(n, p, q);
 
     // Loop until random number is coprime with totient n.
-    do {
+    while (exponent == 0 && mpz_cmp_ui(divisor, 1) != 0) {
         mpz_urandomb(rand, state, bits);
-        gcd(divisor, totient, rand);
-    } while (mpz_cmp_ui(divisor, 1) != 0);
+        gcd_ctx(&ctx, divisor, totient, rand);
+    }
     // Set e equal to the coprime number
     mpz_set(e, rand);
+    num_ctx_clear(&ctx);
     mpz_clears(rand, divisor, p_minus1, q_minus1, totient, NULL);
 }
 
@@ -96,13 +117,29 @@ void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile) {
     fscanf(pbfile, "%s\n", username);
 }
 
+// Initializes the numbers of a private key.
+//
+// k: private key to initialize
+void rsa_priv_init(PrivKey *k) {
+    mpz_inits(k->n, k->d, k->p, k->q, k->dp, k->dq, k->qinv, NULL);
+    k->crt = false;
+}
+
+// Clears the numbers of a private key.
+//
+// k: private key to clear
+void rsa_priv_clear(PrivKey *k) {
+    mpz_clears(k->n, k->d, k->p, k->q, k->dp, k->dq, k->qinv, NULL);
+}
+
 // Makes an RSA private key from primes p and q, and public
-// exponent e.
+// exponent e. Along with d, the key keeps p and q and the exponents
+// and inverse that the Chinese Remainder Theorem needs.
 //
-// d: private key
+// k: private key that is made
 // e: public exponent
 // p and q: two large prime numbers
-void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
+void rsa_make_priv(PrivKey *k, mpz_t e, mpz_t p, mpz_t q) {
     // Calculate totient = (p-1) * (q-1)
     mpz_t totient, p_minus1, q_minus1;
     mpz_inits(totient, p_minus1, q_minus1, NULL);
@@ -112,28 +149,102 @@ void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q) {
     mpz_mul(totient, p_minus1, q_minus1);
 
     // Find modular inverse of e mod totient, output is private key value
-    mod_inverse(d, e, totient);
+    mod_inverse(k->d, e, totient);
+    mpz_mul(k->n, p, q);
+
+    // dp = d mod (p-1), dq = d mod (q-1), qinv = q^-1 mod p
+    mpz_set(k->p, p);
+    mpz_set(k->q, q);
+    mpz_mod(k->dp, k->d, p_minus1);
+    mpz_mod(k->dq, k->d, q_minus1);
+    mod_inverse(k->qinv, q, p);
+    k->crt = true;
     mpz_clears(totient, p_minus1, q_minus1, NULL);
 }
 
-// Writes a private RSA key to pvfile, with n and d  written
-// as hexstrings.
+// Writes a private RSA key to pvfile, with n and d written as
+// hexstrings, followed by p, q, dp, dq, and qinv if the key has them.
+// Programs that only read n and d can still use the key.
 //
-// n: value of p * q
-// d: private key
+// k: private key
 // pvfile: write to this file
-void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile) {
-    gmp_fprintf(pvfile, "%Zx\n%Zx\n", n, d);
+void rsa_write_priv(PrivKey *k, FILE *pvfile) {
+    gmp_fprintf(pvfile, "%Zx\n%Zx\n", k->n, k->d);
+    if (k->crt) {
+        gmp_fprintf(pvfile, "%Zx\n%Zx\n%Zx\n%Zx\n%Zx\n", k->p, k->q, k->dp, k->dq, k->qinv);
+    }
 }
 
-// Reads a private RSA key from pvfile, with n, e, and s written
-// as hexstrings.
+// Reads a private RSA key from pvfile, with n and d written as
+// hexstrings. Keys that go on with p, q, dp, dq, and qinv get crt set
+// as long as p * q is n. Old keys with only n and d have crt cleared,
+// and are used without the Chinese Remainder Theorem.
 //
-// n: value of p * q
-// d: private key
+// k: private key, initialized with rsa_priv_init()
 // pvfile: read from this file
-void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
-    gmp_fscanf(pvfile, "%Zx\n%Zx\n", n, d);
+void rsa_read_priv(PrivKey *k, FILE *pvfile) {
+    gmp_fscanf(pvfile, "%Zx\n%Zx\n", k->n, k->d);
+    int fields
+        = gmp_fscanf(pvfile, "%Zx\n%Zx\n%Zx\n%Zx\n%Zx\n", k->p, k->q, k->dp, k->dq, k->qinv);
+    mpz_t product;
+    mpz_init(product);
+    mpz_mul(product, k->p, k->q);
+    k->crt = fields == 5 && mpz_cmp(product, k->n) == 0;
+    mpz_clear(product);
+}
+
+// Public exponents with at most this many bits, such as 65537, are
+// raised with mont_pow_ui().
+#define SHORT_EXP_BITS 32
+
+// Scratch of one thread: the numbers and NumCtx that it reuses for
+// every block or signature, so that its loop does not allocate.
+typedef struct {
+    NumCtx ctx;
+    mpz_t m, c; // Message and ciphertext of the current block.
+    mpz_t mp, mq; // Halves of a CRT exponentiation.
+} Scratch;
+
+// Creates the scratch of threads threads.
+//
+// threads: number of threads
+static Scratch *scratch_create(uint32_t threads) {
+    Scratch *s = (Scratch *) num_alloc(threads, sizeof(Scratch));
+    for (uint32_t i = 0; i < threads; i += 1) {
+        num_ctx_init(&s[i].ctx);
+        mpz_inits(s[i].m, s[i].c, s[i].mp, s[i].mq, NULL);
+    }
+    return s;
+}
+
+// Frees the scratch of threads threads.
+//
+// s: scratch from scratch_create()
+// threads: number of threads it was created for
+static void scratch_delete(Scratch *s, uint32_t threads) {
+    for (uint32_t i = 0; i < threads; i += 1) {
+        num_ctx_clear(&s[i].ctx);
+        mpz_clears(s[i].m, s[i].c, s[i].mp, s[i].mq, NULL);
+    }
+    free(s);
+}
+
+// Raises a to the public exponent e modulo n, with the Montgomery form
+// of n. A short e, like 65537, goes through square-and-multiply without
+// a table of powers; a long one through the sliding window of
+// mont_pow().
+//
+// o: store computed result here
+// a: base value
+// e: public exponent
+// m: Montgomery form of n
+// ctx: scratch context
+static void pub_pow(mpz_t o, mpz_t a, mpz_t e, Mont *m, NumCtx *ctx) {
+    if (mpz_sizeinbase(e, 2) <= SHORT_EXP_BITS) {
+        mont_pow_ui_ctx(ctx, m, o, a, mpz_get_ui(e));
+    } else {
+        mont_pow_ctx(ctx, m, o, a, e);
+    }
 }
 
 // RSA encrypts a message m into cyphertext c.
@@ -144,95 +255,551 @@ void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile) {
 // n: public modulus
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n) {
     // Performs modular exponentiation and stores result in cyphertext c
-    pow_mod(c, m, e, n);
+    Mont mont;
+    mont_init(&mont, n);
+    NumCtx ctx;
+    num_ctx_init(&ctx);
+    pub_pow(c, m, e, &mont, &ctx);
+    num_ctx_clear(&ctx);
+    mont_clear(&mont);
 }
 
 // RSA encrypts a file infile and prints the encrypted output to
-// outfile.
+// outfile, with each block written as a line with a hexstring.
 //
 // infile: encrypt this file
 // outfile: encrypted output printed to this file
 // n: public modulus
 // e: public exponent
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
+void rsa_encrypt_file_hex(FILE *infile, FILE *outfile, mpz_t n, mpz_t e) {
     // Calculate block size k.
     uint32_t k = (log_base2(n) - 1) / 8;
 
     // Dynamically allocate memory for an array block and
     // set zeroth byte of block to 0xFF.
-    uint8_t *block = (uint8_t *) calloc(k, sizeof(uint8_t));
+    uint8_t *block = (uint8_t *) num_alloc(k, sizeof(uint8_t));
     block[0] = 1;
 
     uint32_t bytes;
     mpz_t read_bytes, m;
     mpz_inits(read_bytes, m, NULL);
+    Mont mont;
+    mont_init(&mont, n);
+    NumCtx ctx;
+    num_ctx_init(&ctx);
     do {
         // Read at most k-1 bytes, store in block after the prepended 0xFF
         bytes = fread(&block[1], sizeof(uint8_t), k - 1, infile);
         // Convert bytes to mpz_t
         mpz_import(read_bytes, bytes + 1, 1, sizeof(uint8_t), 1, 0, block);
         // Encrypt the message
-        rsa_encrypt(m, read_bytes, e, n);
+        pub_pow(m, read_bytes, e, &mont, &ctx);
         if (bytes > 0) {
             // Print the message
             gmp_fprintf(outfile, "%Zx\n", m);
         }
     } while (bytes > 0); // Until there is nothing left to read
+    num_ctx_clear(&ctx);
+    mont_clear(&mont);
     mpz_clears(read_bytes, m, NULL);
     free(block);
 }
 
+// Montgomery forms of the moduli of a key, set up once and then shared
+// by any number of operations with the key, from any number of threads.
+typedef struct {
+    Mont n; // Montgomery form of n, for public keys and keys without CRT.
+    Mont p, q; // Montgomery forms of p and q, for keys with CRT.
+    bool crt; // Whether p and q are set up rather than n.
+} KeyForms;
+
+// Sets up the Montgomery forms that operations with a key need: those
+// of p and q for a private key with its CRT fields, otherwise that of n.
+//
+// f: forms that are set up
+// n: public modulus
+// k: private key, or NULL for a public key
+static void key_forms_init(KeyForms *f, mpz_t n, PrivKey *k) {
+    f->crt = k && k->crt;
+    if (f->crt) {
+        mont_init(&f->p, k->p);
+        mont_init(&f->q, k->q);
+    } else {
+        mont_init(&f->n, n);
+    }
+}
+
+// Frees the Montgomery forms of a key.
+//
+// f: forms to free
+static void key_forms_clear(KeyForms *f) {
+    if (f->crt) {
+        mont_clear(&f->p);
+        mont_clear(&f->q);
+    } else {
+        mont_clear(&f->n);
+    }
+}
+
+// Raises c to the private exponent modulo n. Keys with their CRT
+// fields do it with two exponentiations modulo p and q, which have
+// half the bits of n and exponents half as long, and join the results
+// with Garner's formula. Other keys do one exponentiation modulo n.
+//
+// o: store computed result here
+// c: base value
+// k: private key
+// f: Montgomery forms of k
+// s: scratch of the calling thread
+static void priv_pow(mpz_t o, mpz_t c, PrivKey *k, KeyForms *f, Scratch *s) {
+    if (!k->crt) {
+        mont_pow_ctx(&s->ctx, &f->n, o, c, k->d);
+        return;
+    }
+    // mp = c^dp mod p, mq = c^dq mod q
+    mpz_ptr mp = s->mp, mq = s->mq;
+    mont_pow_ctx(&s->ctx, &f->p, mp, c, k->dp);
+    mont_pow_ctx(&s->ctx, &f->q, mq, c, k->dq);
+
+    // o = mq + q * ((mp - mq) * qinv mod p)
+    mpz_sub(mp, mp, mq);
+    mpz_mul(mp, mp, k->qinv);
+    mpz_mod(mp, mp, k->p);
+    mpz_mul(mp, mp, k->q);
+    mpz_add(o, mq, mp);
+}
+
+// Returns the number of bytes in n, which is the width of every block
+// of a binary ciphertext file.
+//
+// n: public modulus
+static uint32_t cipher_width(mpz_t n) {
+    return (mpz_sizeinbase(n, 2) + 7) / 8;
+}
+
+// Writes value into the width bytes at buf as a big-endian number,
+// padded with leading zeros.
+//
+// buf: width bytes that are written
+// width: bytes in buf
+// value: number to write, which fits in width bytes
+static void export_block(uint8_t *buf, uint32_t width, mpz_t value) {
+    size_t count = (mpz_sizeinbase(value, 2) + 7) / 8;
+    memset(buf, 0, width - count);
+    mpz_export(buf + width - count, NULL, 1, sizeof(uint8_t), 1, 0, value);
+}
+
+// A batch of up to CIPHER_BATCH blocks that the threads of a Pool code
+// together. Thread id codes blocks id, id + threads, and so on, with
+// its own scratch numbers, into its own slot of out.
+typedef struct {
+    const uint8_t *in; // Input of the batch.
+    size_t bytes; // Bytes in the input.
+    uint8_t *out; // Output slot of width bytes for each block.
+    size_t *lengths; // Bytes of output in each slot.
+    uint32_t blocks; // Blocks in the batch.
+    uint32_t k; // Block size of the key.
+    uint32_t width; // Bytes in n.
+    mpz_ptr e; // Public exponent, when encrypting.
+    PrivKey *key; // Private key, when decrypting.
+    KeyForms *forms; // Montgomery forms of the key.
+    Scratch *scratch; // Scratch of each thread.
+    bool *ok; // Whether each thread's blocks were all valid.
+} Batch;
+
+// Creates the buffers and per-thread scratch of a Batch.
+//
+// b: batch to create
+// threads: number of threads that code it
+// k: block size of the key
+// width: bytes in n
+static void batch_init(Batch *b, uint32_t threads, uint32_t k, uint32_t width) {
+    b->k = k;
+    b->width = width;
+    b->out = (uint8_t *) num_alloc(CIPHER_BATCH, width);
+    b->lengths = (size_t *) num_alloc(CIPHER_BATCH, sizeof(size_t));
+    b->scratch = scratch_create(threads);
+    b->ok = (bool *) num_alloc(threads, sizeof(bool));
+}
+
+// Frees the buffers and per-thread scratch of a Batch.
+//
+// b: batch to free
+// threads: number of threads it was created for
+static void batch_clear(Batch *b, uint32_t threads) {
+    scratch_delete(b->scratch, threads);
+    free(b->out);
+    free(b->lengths);
+    free(b->ok);
+}
+
+// Encrypts thread id's share of the blocks of a Batch. Every block is
+// prepended with a 0x01 byte, so that leading zeros in the data
+// survive the trip through a number.
+//
+// arg: the Batch
+// id: thread number
+// threads: number of threads
+static void encrypt_blocks(void *arg, uint32_t id, uint32_t threads) {
+    Batch *b = (Batch *) arg;
+    Scratch *s = &b->scratch[id];
+    for (uint32_t i = id; i < b->blocks; i += threads) {
+        size_t first = (size_t) i * (b->k - 1);
+        size_t count = b->bytes - first < b->k - 1 ? b->bytes - first : b->k - 1;
+        mpz_import(s->m, count, 1, sizeof(uint8_t), 1, 0, b->in + first);
+        mpz_setbit(s->m, 8 * count);
+        pub_pow(s->c, s->m, b->e, &b->forms->n, &s->ctx);
+        export_block(b->out + (size_t) i * b->width, b->width, s->c);
+    }
+}
+
+// Writes the header of a binary ciphertext file.
+//
+// outfile: file the header is written to
+// version: CIPHER_VERSION or CIPHER_HYBRID
+// width: bytes in n
+static void write_header(FILE *outfile, uint8_t version, uint32_t width) {
+    uint8_t header[CIPHER_HEADER] = { 0 };
+    memcpy(header, CIPHER_MAGIC, 4);
+    header[4] = version;
+    for (uint32_t i = 0; i < 4; i += 1) {
+        header[8 + i] = width >> (24 - 8 * i);
+    }
+    fwrite(header, sizeof(uint8_t), CIPHER_HEADER, outfile);
+}
+
+// RSA encrypts a file infile into a binary ciphertext file outfile.
+// The file starts with CIPHER_MAGIC, the format version, three zero
+// bytes, and the byte width of n as a big-endian 32-bit number. Each
+// block of k - 1 bytes then becomes a big-endian number of exactly
+// that width. Input and output move CIPHER_BATCH blocks at a time, and
+// the blocks of each batch are shared out among the threads of pool.
+//
+// infile: encrypt this file
+// outfile: encrypted output written to this file
+// n: public modulus
+// e: public exponent
+// pool: threads that encrypt the blocks
+void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, Pool *pool) {
+    // Calculate block size k and the width of each encrypted block
+    uint32_t k = (log_base2(n) - 1) / 8;
+    uint32_t width = cipher_width(n);
+    write_header(outfile, CIPHER_VERSION, width);
+
+    uint32_t threads = pool_threads(pool);
+    uint8_t *in = (uint8_t *) num_alloc(CIPHER_BATCH, k - 1);
+    KeyForms forms;
+    key_forms_init(&forms, n, NULL);
+    Batch batch = { .in = in, .e = e, .forms = &forms };
+    batch_init(&batch, threads, k, width);
+    while ((batch.bytes = fread(in, sizeof(uint8_t), (size_t) CIPHER_BATCH * (k - 1), infile))
+           > 0) {
+        batch.blocks = (batch.bytes + k - 2) / (k - 1);
+        pool_run(pool, encrypt_blocks, &batch);
+        fwrite(batch.out, width, batch.blocks, outfile);
+    }
+    batch_clear(&batch, threads);
+    key_forms_clear(&forms);
+    free(in);
+}
+
+// Part of a hybrid file body that the threads of a Pool encrypt or
+// decrypt together. Thread id does a run of whole SPECK blocks.
+typedef struct {
+    Speck *speck; // Session key.
+    uint64_t nonce; // Session nonce.
+    uint64_t counter; // SPECK block of the stream that buf starts at.
+    uint8_t *buf; // Bytes of the body.
+    size_t bytes; // Bytes in buf.
+} Stream;
+
+// Encrypts or decrypts thread id's share of a Stream.
+//
+// arg: the Stream
+// id: thread number
+// threads: number of threads
+static void stream_blocks(void *arg, uint32_t id, uint32_t threads) {
+    Stream *s = (Stream *) arg;
+    size_t blocks = (s->bytes + SPECK_BLOCK - 1) / SPECK_BLOCK;
+    size_t share = (blocks + threads - 1) / threads;
+    size_t first = id * share;
+    size_t last = first + share < blocks ? first + share : blocks;
+    if (first < last) {
+        size_t start = first * SPECK_BLOCK;
+        size_t end = last * SPECK_BLOCK < s->bytes ? last * SPECK_BLOCK : s->bytes;
+        speck_ctr(s->speck, s->nonce, s->counter + first, s->buf + start, end - start);
+    }
+}
+
+// Copies infile to outfile through SPECK in counter mode, STREAM_CHUNK
+// bytes at a time, with each chunk shared out among the threads of pool.
+//
+// infile: file that is read
+// outfile: file that is written
+// session: SPECK key followed by the nonce as a little-endian number
+// pool: threads that encrypt or decrypt the chunks
+static void stream_file(FILE *infile, FILE *outfile, uint8_t session[SESSION_BYTES], Pool *pool) {
+    Speck speck;
+    speck_init(&speck, session);
+    Stream s = { .speck = &speck };
+    for (uint32_t i = 0; i < 8; i += 1) {
+        s.nonce |= (uint64_t) session[SPECK_KEY + i] << (8 * i);
+    }
+    s.buf = (uint8_t *) num_alloc(STREAM_CHUNK, sizeof(uint8_t));
+    while ((s.bytes = fread(s.buf, sizeof(uint8_t), STREAM_CHUNK, infile)) > 0) {
+        pool_run(pool, stream_blocks, &s);
+        fwrite(s.buf, sizeof(uint8_t), s.bytes, outfile);
+        s.counter += STREAM_CHUNK / SPECK_BLOCK;
+    }
+    free(s.buf);
+}
+
+// Fills buf with random bytes from the operating system, which unlike
+// the seeded random state cannot be guessed. Returns false if there
+// are none to be had.
+//
+// buf: bytes to fill
+// bytes: bytes in buf
+static bool random_bytes(uint8_t *buf, size_t bytes) {
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (!urandom) {
+        return false;
+    }
+    bool ok = fread(buf, sizeof(uint8_t), bytes, urandom) == bytes;
+    fclose(urandom);
+    return ok;
+}
+
+// RSA encrypts a file infile into a hybrid ciphertext file outfile.
+// RSA only wraps a random SPECK key and nonce, and the data is
+// encrypted with SPECK in counter mode, so that large files cost one
+// RSA operation instead of one per block. The file has the header of
+// rsa_encrypt_file() with version CIPHER_HYBRID, then one RSA block of
+// k bytes: a 0x01 byte, random padding, and the session key and nonce
+// at the end. The padding makes the block close to n in size, so that
+// it wraps around n even for a small e. Then comes the data, as many
+// bytes as went in. Returns false if n is too small to wrap the
+// session or no random bytes could be read.
+//
+// infile: encrypt this file
+// outfile: encrypted output written to this file
+// n: public modulus
+// e: public exponent
+// pool: threads that encrypt the data
+bool rsa_encrypt_file_hybrid(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, Pool *pool) {
+    uint32_t k = (log_base2(n) - 1) / 8;
+    uint32_t width = cipher_width(n);
+    uint8_t session[SESSION_BYTES];
+    uint8_t *block = (uint8_t *) num_alloc(width, sizeof(uint8_t));
+    if (k < SESSION_BYTES + 1 || !random_bytes(session, SESSION_BYTES)
+        || !random_bytes(block, k)) {
+        free(block);
+        return false;
+    }
+    write_header(outfile, CIPHER_HYBRID, width);
+
+    mpz_t m, c;
+    mpz_inits(m, c, NULL);
+    block[0] = 1;
+    memcpy(block + k - SESSION_BYTES, session, SESSION_BYTES);
+    mpz_import(m, k, 1, sizeof(uint8_t), 1, 0, block);
+    rsa_encrypt(c, m, e, n);
+    export_block(block, width, c);
+    fwrite(block, sizeof(uint8_t), width, outfile);
+    free(block);
+    mpz_clears(m, c, NULL);
+
+    stream_file(infile, outfile, session, pool);
+    memset(session, 0, SESSION_BYTES);
+    return true;
+}
+
 // RSA decrypts a cyphertext c into message m.
 //
 // m: message from encrypted cyphertext
 // c: encrypted cyphertext
-// d: private key
-// n: public modulus
-void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n) {
+// k: private key
+void rsa_decrypt(mpz_t m, mpz_t c, PrivKey *k) {
     // Performs modular exponentiation and stores result in message m
-    pow_mod(m, c, d, n);
+    KeyForms f;
+    key_forms_init(&f, k->n, k);
+    Scratch *s = scratch_create(1);
+    priv_pow(m, c, k, &f, s);
+    scratch_delete(s, 1);
+    key_forms_clear(&f);
 }
 
-// RSA decrypts an encrypted file infile and writes the
-// decrypted file to outfile.
+// RSA decrypts a file infile of hexstring lines written by
+// rsa_encrypt_file_hex() and writes the decrypted file to outfile.
 //
 // infile: decrypt this encrypted file
 // outfile: decrypted file written here
-// n: public modulus
-// d: private key
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d) {
+// key: private key
+static void decrypt_file_hex(FILE *infile, FILE *outfile, PrivKey *key) {
     // Calculate block size k
-    uint32_t k = (log_base2(n) - 1) / 8;
+    uint32_t k = (log_base2(key->n) - 1) / 8;
 
     // Dynamically allocate memory for a block array
-    uint8_t *block = (uint8_t *) calloc(k, sizeof(uint8_t));
+    uint8_t *block = (uint8_t *) num_alloc(k, sizeof(uint8_t));
 
     uint64_t j;
-    mpz_t m, c;
-    mpz_inits(m, c, NULL);
+    KeyForms forms;
+    key_forms_init(&forms, key->n, key);
+    Scratch *s = scratch_create(1);
+    mpz_ptr m = s->m, c = s->c;
     do {
         // Scan hexstring and store in c
         gmp_fscanf(infile, "%Zx\n", c);
         // Decrypt the cyphertext c
-        rsa_decrypt(m, c, d, n);
+        priv_pow(m, c, key, &forms, s);
         // Convert mpz_t to bytes
         mpz_export(block, &j, 1, sizeof(uint8_t), 1, 0, m);
         // Write the decrypted message
         fwrite(&block[1], sizeof(uint8_t), j - 1, outfile);
     } while (!feof(infile)); // Until the end of file is reached
-    mpz_clears(m, c, NULL);
+    scratch_delete(s, 1);
+    key_forms_clear(&forms);
     free(block);
 }
 
+// Decrypts thread id's share of the blocks of a Batch, and checks and
+// drops the 0x01 byte that was prepended to each of them.
+//
+// arg: the Batch
+// id: thread number
+// threads: number of threads
+static void decrypt_blocks(void *arg, uint32_t id, uint32_t threads) {
+    Batch *b = (Batch *) arg;
+    Scratch *s = &b->scratch[id];
+    b->ok[id] = true;
+    for (uint32_t i = id; i < b->blocks; i += threads) {
+        uint8_t *slot = b->out + (size_t) i * b->width;
+        size_t count = 0;
+        mpz_import(s->c, b->width, 1, sizeof(uint8_t), 1, 0, b->in + (size_t) i * b->width);
+        priv_pow(s->m, s->c, b->key, b->forms, s);
+        mpz_export(slot, &count, 1, sizeof(uint8_t), 1, 0, s->m);
+        b->ok[id] = b->ok[id] && count > 0 && slot[0] == 1;
+        b->lengths[i] = count > 0 ? count - 1 : 0;
+    }
+}
+
+// Decrypts the rest of a hybrid ciphertext file after its header:
+// unwraps the session key and nonce with the private key, and then
+// decrypts the data with them. The session is at the end of the block,
+// after the 0x01 byte and any padding, which files written before the
+// padding was added do not have. Returns false if the session block is
+// missing or did not come from this key.
+//
+// infile: decrypt this encrypted file
+// outfile: decrypted file written here
+// key: private key
+// width: bytes in n
+// pool: threads that decrypt the data
+static bool decrypt_file_hybrid(
+    FILE *infile, FILE *outfile, PrivKey *key, uint32_t width, Pool *pool) {
+    uint8_t *block = (uint8_t *) num_alloc(width, sizeof(uint8_t));
+    bool ok = fread(block, sizeof(uint8_t), width, infile) == width;
+    size_t count = 0;
+    if (ok) {
+        mpz_t m, c;
+        mpz_inits(m, c, NULL);
+        mpz_import(c, width, 1, sizeof(uint8_t), 1, 0, block);
+        rsa_decrypt(m, c, key);
+        mpz_export(block, &count, 1, sizeof(uint8_t), 1, 0, m);
+        mpz_clears(m, c, NULL);
+    }
+    ok = ok && count > SESSION_BYTES && block[0] == 1;
+    if (ok) {
+        stream_file(infile, outfile, block + count - SESSION_BYTES, pool);
+    }
+    memset(block, 0, width);
+    free(block);
+    return ok;
+}
+
+// RSA decrypts a ciphertext file infile and writes the decrypted file
+// to outfile. Binary files from rsa_encrypt_file() are read
+// CIPHER_BATCH blocks at a time, and the blocks of each batch are
+// shared out among the threads of pool, as are the chunks of hybrid
+// files from rsa_encrypt_file_hybrid(). Anything else is read as
+// hexstring lines from rsa_encrypt_file_hex(), on one thread. Returns
+// false if a binary file has an unknown version, was made for a
+// different modulus, or ends partway through a block.
+//
+// infile: decrypt this encrypted file
+// outfile: decrypted file written here
+// key: private key
+// pool: threads that decrypt the blocks
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, PrivKey *key, Pool *pool) {
+    // Hexstrings never start with the R of CIPHER_MAGIC
+    int first = getc(infile);
+    if (first == EOF) {
+        return true;
+    }
+    ungetc(first, infile);
+    if (first != CIPHER_MAGIC[0]) {
+        decrypt_file_hex(infile, outfile, key);
+        return true;
+    }
+
+    uint32_t width = cipher_width(key->n);
+    uint8_t header[CIPHER_HEADER];
+    if (fread(header, sizeof(uint8_t), CIPHER_HEADER, infile) != CIPHER_HEADER
+        || memcmp(header, CIPHER_MAGIC, 4) != 0
+        || ((uint32_t) header[8] << 24 | header[9] << 16 | header[10] << 8 | header[11])
+               != width) {
+        return false;
+    }
+    if (header[4] == CIPHER_HYBRID) {
+        return decrypt_file_hybrid(infile, outfile, key, width, pool);
+    }
+    if (header[4] != CIPHER_VERSION) {
+        return false;
+    }
+
+    uint32_t threads = pool_threads(pool);
+    uint8_t *in = (uint8_t *) num_alloc(CIPHER_BATCH, width);
+    KeyForms forms;
+    key_forms_init(&forms, key->n, key);
+    Batch batch = { .in = in, .key = key, .forms = &forms };
+    batch_init(&batch, threads, (log_base2(key->n) - 1) / 8, width);
+    bool ok = true;
+    while (ok && (batch.bytes = fread(in, sizeof(uint8_t), (size_t) CIPHER_BATCH * width, infile))
+                     > 0) {
+        ok = batch.bytes % width == 0;
+        batch.blocks = batch.bytes / width;
+        pool_run(pool, decrypt_blocks, &batch);
+
+        // Pack the blocks together in order and write them out
+        size_t length = 0;
+        for (uint32_t i = 0; i < threads; i += 1) {
+            ok = ok && batch.ok[i];
+        }
+        for (uint32_t i = 0; ok && i < batch.blocks; i += 1) {
+            memmove(batch.out + length, batch.out + (size_t) i * width + 1, batch.lengths[i]);
+            length += batch.lengths[i];
+        }
+        fwrite(batch.out, sizeof(uint8_t), length, outfile);
+    }
+    batch_clear(&batch, threads);
+    key_forms_clear(&forms);
+    free(in);
+    return ok;
+}
+
 // Performs RSA signing to create a signature s on message m.
 //
 // s: signature
 // m: message being signed
-// d: private key
-// n: public modulus
-void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n) {
+// k: private key
+void rsa_sign(mpz_t s, mpz_t m, PrivKey *k) {
     // Performs modular exponentiation and stores result in signature s
-    pow_mod(s, m, d, n);
+    KeyForms f;
+    key_forms_init(&f, k->n, k);
+    Scratch *scratch = scratch_create(1);
+    priv_pow(s, m, k, &f, scratch);
+    scratch_delete(scratch, 1);
+    key_forms_clear(&f);
 }
 
 // RSA verification function, if the signature is verified,
@@ -248,7 +815,13 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_init(t);
 
     // Performs modular exponentiation and stores result in t
-    pow_mod(t, s, e, n);
+    Mont mont;
+    mont_init(&mont, n);
+    NumCtx ctx;
+    num_ctx_init(&ctx);
+    pub_pow(t, s, e, &mont, &ctx);
+    num_ctx_clear(&ctx);
+    mont_clear(&mont);
 
     // If t and m are the same, the signature is verified
     // and return true, otherwise return false
@@ -259,3 +832,104 @@ bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n) {
     mpz_clear(t);
     return false;
 }
+
+// A batch of messages and signatures for one key that the threads of a
+// Pool sign or verify together. Thread id takes entries id,
+// id + threads, and so on.
+typedef struct {
+    mpz_t *m; // Messages.
+    mpz_t *s; // Signatures.
+    bool *valid; // Whether each signature is valid, when verifying.
+    uint32_t count; // Entries in the batch.
+    mpz_ptr e; // Public exponent, when verifying.
+    PrivKey *key; // Private key, when signing.
+    KeyForms *forms; // Montgomery forms of the key.
+    Scratch *scratch; // Scratch of each thread.
+} Signatures;
+
+// Signs thread id's share of a batch of messages.
+//
+// arg: the Signatures
+// id: thread number
+// threads: number of threads
+static void sign_entries(void *arg, uint32_t id, uint32_t threads) {
+    Signatures *b = (Signatures *) arg;
+    for (uint32_t i = id; i < b->count; i += threads) {
+        priv_pow(b->s[i], b->m[i], b->key, b->forms, &b->scratch[id]);
+    }
+}
+
+// Verifies thread id's share of a batch of signatures.
+//
+// arg: the Signatures
+// id: thread number
+// threads: number of threads
+static void verify_entries(void *arg, uint32_t id, uint32_t threads) {
+    Signatures *b = (Signatures *) arg;
+    Scratch *s = &b->scratch[id];
+    for (uint32_t i = id; i < b->count; i += threads) {
+        pub_pow(s->m, b->s[i], b->e, &b->forms->n, &s->ctx);
+        b->valid[i] = mpz_cmp(s->m, b->m[i]) == 0;
+    }
+}
+
+// Runs task on a batch, on the threads of pool or on the caller if pool
+// is NULL, with scratch for each thread.
+//
+// b: the batch
+// task: sign_entries() or verify_entries()
+// pool: threads that share the batch, or NULL
+static void run_signatures(Signatures *b, PoolTask task, Pool *pool) {
+    uint32_t threads = pool ? pool_threads(pool) : 1;
+    b->scratch = scratch_create(threads);
+    if (pool) {
+        pool_run(pool, task, b);
+    } else {
+        task(b, 0, 1);
+    }
+    scratch_delete(b->scratch, threads);
+}
+
+// Signs count messages with one private key, the same as rsa_sign() on
+// each of them. The Montgomery forms of the key are set up once for the
+// whole batch, and the messages are shared out among the threads of
+// pool.
+//
+// s: signature of each message
+// m: messages being signed
+// count: number of messages
+// k: private key
+// pool: threads that sign the messages, or NULL to sign them on the caller
+void rsa_sign_batch(mpz_t *s, mpz_t *m, uint32_t count, PrivKey *k, Pool *pool) {
+    KeyForms f;
+    key_forms_init(&f, k->n, k);
+    Signatures b = { .m = m, .s = s, .count = count, .key = k, .forms = &f };
+    run_signatures(&b, sign_entries, pool);
+    key_forms_clear(&f);
+}
+
+// Verifies count signatures with one public key, the same as
+// rsa_verify() on each of them. The Montgomery form of n is set up once
+// for the whole batch, and the signatures are shared out among the
+// threads of pool. Returns the number of valid signatures.
+//
+// valid: whether each signature is valid
+// m: expected messages
+// s: signatures
+// count: number of signatures
+// e: public exponent
+// n: public modulus
+// pool: threads that verify the signatures, or NULL to verify them on the caller
+uint32_t rsa_verify_batch(
+    bool *valid, mpz_t *m, mpz_t *s, uint32_t count, mpz_t e, mpz_t n, Pool *pool) {
+    KeyForms f;
+    key_forms_init(&f, n, NULL);
+    Signatures b = { .m = m, .s = s, .valid = valid, .count = count, .e = e, .forms = &f };
+    run_signatures(&b, verify_entries, pool);
+    key_forms_clear(&f);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; i += 1) {
+        total += valid[i];
+    }
+    return total;
+}
@@ -1,30 +1,62 @@
 #pragma once
 
+#include "pool.h"
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <gmp.h>
 
-void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters);
+// Smallest fixed public exponent keygen accepts. Blocks are not padded,
+// so a small block raised to a smaller e may never wrap around n and
+// could be recovered with an integer root.
+#define MIN_EXPONENT 65537
+
+// RSA private key. Keys written before the CRT fields were added only
+// hold n and d, and are read back with crt set to false.
+typedef struct {
+    mpz_t n; // Public modulus.
+    mpz_t d; // Private exponent.
+    mpz_t p, q; // Primes of n.
+    mpz_t dp, dq; // d mod (p - 1) and d mod (q - 1).
+    mpz_t qinv; // Inverse of q modulo p.
+    bool crt; // Whether p, q, dp, dq, and qinv are set.
+} PrivKey;
+
+void rsa_make_pub(mpz_t p, mpz_t q, mpz_t n, mpz_t e, uint64_t nbits, uint64_t iters,
+    uint64_t exponent, Pool *pool);
 
 void rsa_write_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
 void rsa_read_pub(mpz_t n, mpz_t e, mpz_t s, char username[], FILE *pbfile);
 
-void rsa_make_priv(mpz_t d, mpz_t e, mpz_t p, mpz_t q);
+void rsa_priv_init(PrivKey *k);
+
+void rsa_priv_clear(PrivKey *k);
 
-void rsa_write_priv(mpz_t n, mpz_t d, FILE *pvfile);
+void rsa_make_priv(PrivKey *k, mpz_t e, mpz_t p, mpz_t q);
 
-void rsa_read_priv(mpz_t n, mpz_t d, FILE *pvfile);
+void rsa_write_priv(PrivKey *k, FILE *pvfile);
+
+void rsa_read_priv(PrivKey *k, FILE *pvfile);
 
 void rsa_encrypt(mpz_t c, mpz_t m, mpz_t e, mpz_t n);
 
-void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
+void rsa_encrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, Pool *pool);
+
+void rsa_encrypt_file_hex(FILE *infile, FILE *outfile, mpz_t n, mpz_t e);
 
-void rsa_decrypt(mpz_t m, mpz_t c, mpz_t d, mpz_t n);
+bool rsa_encrypt_file_hybrid(FILE *infile, FILE *outfile, mpz_t n, mpz_t e, Pool *pool);
 
-void rsa_decrypt_file(FILE *infile, FILE *outfile, mpz_t n, mpz_t d);
+void rsa_decrypt(mpz_t m, mpz_t c, PrivKey *k);
 
-void rsa_sign(mpz_t s, mpz_t m, mpz_t d, mpz_t n);
+bool rsa_decrypt_file(FILE *infile, FILE *outfile, PrivKey *k, Pool *pool);
+
+void rsa_sign(mpz_t s, mpz_t m, PrivKey *k);
 
 bool rsa_verify(mpz_t m, mpz_t s, mpz_t e, mpz_t n);
+
+void rsa_sign_batch(mpz_t *s, mpz_t *m, uint32_t count, PrivKey *k, Pool *pool);
+
+uint32_t rsa_verify_batch(
+    bool *valid, mpz_t *m, mpz_t *s, uint32_t count, mpz_t e, mpz_t n, Pool *pool);
@@ -0,0 +1,97 @@
+#include "speck.h"
+
+#include <string.h>
+
+// Ray Beaulieu, Stefan Treatman-Clark, Douglas Shors, Bryan Weeks, Jason
+// Smith and Louis Wingers. "The SIMON and SPECK lightweight block ciphers,"
+// In proceedings of the Design Automation Conference (DAC),
+// 2015 52nd ACM/EDAC/IEEE, pp. 1-6. IEEE, 2015.
+
+#define LCS(X, K) (X << K) | (X >> (sizeof(uint64_t) * 8 - K)) // left circular shift
+#define RCS(X, K) (X >> K) | (X << (sizeof(uint64_t) * 8 - K)) // right circular shift
+
+// Core SPECK operation
+#define R(x, y, k) (x = RCS(x, 8), x += y, x ^= k, y = LCS(y, 3), y ^= x)
+
+// Blocks of keystream computed side by side. The rounds of independent
+// blocks do not wait on each other, and the compiler can run them in
+// vector registers.
+#define SPECK_LANES 8
+
+// Reads 8 bytes as a little-endian number.
+//
+// b: bytes to read
+static uint64_t load_le(const uint8_t *b) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < 8; i += 1) {
+        v |= (uint64_t) b[i] << (8 * i);
+    }
+    return v;
+}
+
+// Expands a 16-byte key, two little-endian words, into the round keys.
+//
+// s: cipher to set up
+// key: the key
+void speck_init(Speck *s, const uint8_t key[SPECK_KEY]) {
+    uint64_t A = load_le(key), B = load_le(key + 8);
+    for (uint64_t i = 0; i < SPECK_ROUNDS; i += 1) {
+        s->rk[i] = A;
+        R(B, A, i);
+    }
+}
+
+// Encrypts one block, the same as speck_expand_key_and_encrypt() in
+// asgn7 with the key s was set up with.
+//
+// s: cipher
+// pt: plaintext words
+// ct: ciphertext words
+void speck_encrypt(Speck *s, uint64_t pt[2], uint64_t ct[2]) {
+    ct[0] = pt[0];
+    ct[1] = pt[1];
+    for (uint32_t i = 0; i < SPECK_ROUNDS; i += 1) {
+        R(ct[1], ct[0], s->rk[i]);
+    }
+}
+
+// XORs bytes of the keystream of SPECK in counter mode into buf. Block
+// i of the keystream is the encryption of (counter + i, nonce), written
+// out as two little-endian words, so a buffer that starts at byte
+// 16 * counter of a stream can be done apart from the rest of it.
+// Encrypting and decrypting are the same.
+//
+// s: cipher
+// nonce: nonce of the stream
+// counter: block of the stream that buf starts at
+// buf: bytes to encrypt or decrypt
+// bytes: bytes in buf
+void speck_ctr(Speck *s, uint64_t nonce, uint64_t counter, uint8_t *buf, size_t bytes) {
+    uint8_t stream[SPECK_LANES * SPECK_BLOCK];
+    while (bytes > 0) {
+        uint64_t x[SPECK_LANES], y[SPECK_LANES];
+        for (uint32_t l = 0; l < SPECK_LANES; l += 1) {
+            y[l] = counter + l;
+            x[l] = nonce;
+        }
+        for (uint32_t i = 0; i < SPECK_ROUNDS; i += 1) {
+            uint64_t k = s->rk[i];
+            for (uint32_t l = 0; l < SPECK_LANES; l += 1) {
+                R(x[l], y[l], k);
+            }
+        }
+        for (uint32_t l = 0; l < SPECK_LANES; l += 1) {
+            for (uint32_t i = 0; i < 8; i += 1) {
+                stream[l * SPECK_BLOCK + i] = y[l] >> (8 * i);
+                stream[l * SPECK_BLOCK + 8 + i] = x[l] >> (8 * i);
+            }
+        }
+        size_t count = bytes < sizeof(stream) ? bytes : sizeof(stream);
+        for (size_t i = 0; i < count; i += 1) {
+            buf[i] ^= stream[i];
+        }
+        buf += count;
+        bytes -= count;
+        counter += SPECK_LANES;
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPECK_ROUNDS 32 // Rounds of SPECK128/128.
+#define SPECK_BLOCK  16 // Bytes in a SPECK block.
+#define SPECK_KEY    16 // Bytes in a SPECK key.
+
+// SPECK128/128 with its round keys expanded once, so that any number of
+// blocks can be encrypted with them.
+typedef struct {
+    uint64_t rk[SPECK_ROUNDS]; // Key of each round.
+} Speck;
+
+void speck_init(Speck *s, const uint8_t key[SPECK_KEY]);
+
+void speck_encrypt(Speck *s, uint64_t pt[2], uint64_t ct[2]);
+
+void speck_ctr(Speck *s, uint64_t nonce, uint64_t counter, uint8_t *buf, size_t bytes);